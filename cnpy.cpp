@@ -10,6 +10,7 @@
 #include "cnpy.h"
 
 #include <cstdlib>
+#include <cstring>
 #include <iomanip>
 #include <stdexcept>
 #include <sstream>
@@ -17,8 +18,35 @@
 #include <cassert>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <ctime>
+#include <cmath>
 
-#include <zip.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <climits>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <zlib.h>
+#ifdef CNPY_HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+#ifdef CNPY_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef CNPY_HAVE_LZ4
+#include <lz4frame.h>
+#endif
 
 
 typedef std::pair<std::string, cnpy::NpArray> NpArrayDictItem;
@@ -29,22 +57,6 @@ static int closefile(std::FILE* fp)
     return std::fclose(fp);
 }
 
-static int closefile(struct zip* fp)
-{
-    return zip_close(fp);
-}
-
-static int closefile(struct zip_file* fp)
-{
-    return zip_fclose(fp);
-}
-
-static int closefile(struct zip_source* fp)
-{
-    // zip_source is reference counted.
-    return 0;
-}
-
 template<typename _Tp>
 class Handler
 {
@@ -63,6 +75,234 @@ private:
 };
 
 
+/**
+ * @brief Owner of a POSIX file descriptor, closed on destruction.
+ */
+class FileDescriptor
+{
+public:
+    FileDescriptor(int fd=-1): h(fd) {}
+    ~FileDescriptor() { if(h>=0) ::close(h); }
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+    int handle() const { return h; }
+    void close() { if(h>=0) ::close(h); h = -1; }
+private:
+    int h;
+};
+
+
+/** Size of the buffers used to read large ranges of a file in pieces */
+static const uint64_t READ_CHUNK_SIZE = 8 << 20;
+/** Unneeded bytes between two ranges that are cheaper to read than to skip with a seek */
+static const uint64_t READ_COALESCE_GAP = 256 << 10;
+/** Size of the buffer of compressed bytes fed to the decoder */
+static const uint64_t INFLATE_INPUT_SIZE = 256 << 10;
+/** Bytes read at the beginning of an entry to peek its local and npy headers */
+static const uint64_t NPZ_PEEK_SIZE = 4096;
+/** Size of the buffer receiving the output of the encoder */
+static const uint64_t DEFLATE_OUTPUT_SIZE = 256 << 10;
+/** Size of the blocks compressed independently by parallel deflate */
+static const size_t DEFLATE_BLOCK_SIZE = 1 << 20;
+/** Largest number of threads compressing an array */
+static const unsigned MAX_ENCODER_THREADS = 1024;
+/** Size of the deflate window, used as dictionary by the next block */
+static const size_t DEFLATE_DICTIONARY_SIZE = 32 << 10;
+/** Upper bound of the bytes added to a block by a sync flush */
+static const size_t DEFLATE_BLOCK_OVERHEAD = 16;
+/** Bytes handed to the encoders at a time */
+static const size_t ENCODER_INPUT_SIZE = 1 << 20;
+/** Size of the blocks shuffled independently, before rounding to whole groups of elements */
+static const size_t FILTER_BLOCK_SIZE = 256 << 10;
+/** Size and number of the samples compressed to choose the compression of an array */
+static const size_t AUTO_SAMPLE_SIZE = 64 << 10;
+static const size_t AUTO_SAMPLE_COUNT = 8;
+/** Compressed to original size ratio of the samples above which an array is stored */
+static const double AUTO_STORE_RATIO = 0.9;
+/** Ratio of the sizes at the default and fastest levels below which the default level is used */
+static const double AUTO_LEVEL_GAIN = 0.95;
+
+
+/**
+ * @brief Read exactly `len` bytes at `offset` from a file descriptor
+ * @throws std::runtime_error On read errors or if the file is too short
+ */
+static void preadAll(const int fd, void* buffer, size_t len, uint64_t offset, const std::string& fname)
+{
+    unsigned char* dst = reinterpret_cast<unsigned char*>(buffer);
+    while(len>0)
+    {
+        ssize_t nread = ::pread(fd, dst, len, offset);
+        if(nread<0 && errno==EINTR)
+            continue;
+        if(nread<=0)
+            throw std::runtime_error("Error reading "+std::to_string(len)+" bytes at offset "+std::to_string(offset)+" of "+fname);
+        dst += nread;
+        len -= nread;
+        offset += nread;
+    }
+}
+
+/**
+ * @brief Write exactly `len` bytes at `offset` to a file descriptor
+ * @throws std::runtime_error On write errors
+ */
+static void pwriteAll(const int fd, const void* buffer, size_t len, uint64_t offset, const std::string& fname)
+{
+    const unsigned char* src = reinterpret_cast<const unsigned char*>(buffer);
+    while(len>0)
+    {
+        ssize_t nwritten = ::pwrite(fd, src, len, offset);
+        if(nwritten<0 && errno==EINTR)
+            continue;
+        if(nwritten<=0)
+            throw std::runtime_error("Error writing "+std::to_string(len)+" bytes at offset "+std::to_string(offset)+" of "+fname);
+        src += nwritten;
+        len -= nwritten;
+        offset += nwritten;
+    }
+}
+
+
+/**
+ * @brief Mapping of a whole file.
+ *
+ * Instances are shared between all the NpArray that view the file, the
+ * mapping is released when the last of them is destroyed.
+ */
+class cnpy::MemoryMap
+{
+public:
+    MemoryMap(const std::string& fname, const MapMode mode=MapMode::ReadOnly):
+        mData(nullptr),
+        mSize(0),
+        mMode(mode)
+    {
+        FileDescriptor fd(::open(fname.c_str(), mode==MapMode::ReadWrite ? O_RDWR : O_RDONLY));
+        if(fd.handle()<0)
+            throw std::runtime_error("Error opening file "+fname);
+        map(fd.handle(), fname);
+    }
+
+    /**
+     * @brief Map a file already opened with an access compatible with `mode`
+     *
+     * The descriptor is not closed by the mapping.
+     */
+    MemoryMap(const int fd, const std::string& fname, const MapMode mode):
+        mData(nullptr),
+        mSize(0),
+        mMode(mode)
+    {
+        map(fd, fname);
+    }
+
+    ~MemoryMap()
+    {
+        if(mData!=nullptr)
+            ::munmap(mData, mSize);
+    }
+
+    MemoryMap(const MemoryMap&) = delete;
+    MemoryMap& operator=(const MemoryMap&) = delete;
+
+    unsigned char* data() { return mData; }
+    size_t size() const { return mSize; }
+    MapMode mode() const { return mMode; }
+
+    /**
+     * @brief Synchronize a range of a MapMode::ReadWrite mapping with the file
+     * @param offset Offset of the first byte of the range
+     * @param len Length of the range
+     * @param async If true do not wait for the write to complete
+     */
+    void flush(const size_t offset, const size_t len, const bool async)
+    {
+        if(mMode!=MapMode::ReadWrite || mData==nullptr || len==0)
+            return;
+
+        // msync wants a page aligned address
+        const size_t pageSize = ::sysconf(_SC_PAGESIZE);
+        const size_t begin = offset - offset % pageSize;
+        if(::msync(mData+begin, offset+len-begin, async ? MS_ASYNC : MS_SYNC)!=0)
+            throw std::runtime_error("Error synchronizing the memory mapped file");
+    }
+
+private:
+    void map(const int fd, const std::string& fname)
+    {
+        struct stat st;
+        if(::fstat(fd, &st)!=0)
+            throw std::runtime_error("Error reading the size of "+fname);
+        mSize = st.st_size;
+
+        if(mSize>0)
+        {
+            int prot = PROT_READ;
+            int flags = MAP_SHARED;
+            if(mMode==MapMode::ReadWrite)
+                prot |= PROT_WRITE;
+            else if(mMode==MapMode::CopyOnWrite)
+            {
+                prot |= PROT_WRITE;
+                flags = MAP_PRIVATE;
+            }
+
+            // The mapping stays valid after the descriptor is closed
+            void* addr = ::mmap(nullptr, mSize, prot, flags, fd, 0);
+            if(addr==MAP_FAILED)
+                throw std::runtime_error("Error mapping file "+fname);
+            mData = reinterpret_cast<unsigned char*>(addr);
+        }
+    }
+
+    unsigned char* mData;
+    size_t mSize;
+    MapMode mMode;
+};
+
+
+void cnpy::NpArray::flush(const bool async)
+{
+    if(mMapping)
+        mMapping->flush(mData-mMapping->data(), mDataSize, async);
+}
+
+
+static uint16_t readLE16(const unsigned char* p)
+{
+    return uint16_t(p[0]) | uint16_t(p[1])<<8;
+}
+
+static uint32_t readLE32(const unsigned char* p)
+{
+    return uint32_t(readLE16(p)) | uint32_t(readLE16(p+2))<<16;
+}
+
+static uint64_t readLE64(const unsigned char* p)
+{
+    return uint64_t(readLE32(p)) | uint64_t(readLE32(p+4))<<32;
+}
+
+static void writeLE16(std::vector<unsigned char>& out, const uint16_t v)
+{
+    out.push_back(v & 0xFF);
+    out.push_back(v >> 8);
+}
+
+static void writeLE32(std::vector<unsigned char>& out, const uint32_t v)
+{
+    writeLE16(out, v & 0xFFFF);
+    writeLE16(out, v >> 16);
+}
+
+static void writeLE64(std::vector<unsigned char>& out, const uint64_t v)
+{
+    writeLE32(out, v & 0xFFFFFFFF);
+    writeLE32(out, v >> 32);
+}
+
+
 struct NpHeader_
 {
     uint8_t x93 = 0x93;
@@ -76,6 +316,10 @@ typedef struct NpHeader_ NpHeader;
 
 static_assert(sizeof(NpHeader)==(1+5+1+1+2), "The npy header struct must be 10 bytes");
 
+static const size_t NPY_MAGIC_SIZE = 8;         //!< Magic string and version
+static const size_t NPY_PREAMBLE_V2_SIZE = 12;  //!< Magic string, version and 32 bits dict size
+static const size_t NPY_MAX_ALIGNMENT = 4096;   //!< numpy refuses headers larger than 10000 bytes by default
+
 static char BigEndianTest()
 {
     unsigned char x[] = {1, 0};
@@ -171,10 +415,28 @@ template<typename T> std::string tostring(T i, int pad = 0, char padval = ' ')
     return s.str();
 }
 
+/**
+ * @brief Create the header of a npy file
+ * @param alignment The header is padded so that the data starts at a
+ *        multiple of `alignment` bytes from the beginning of the file
+ * @param headerSize If not 0 the header is padded to exactly `headerSize`
+ *        bytes instead, and an empty vector is returned if it does not fit
+ *
+ * A version 1.0 header is created unless the padded dict does not fit its
+ * 16 bits length field; a version 2.0 header is created in that case.
+ */
 static std::vector<char> create_npy_header(const cnpy::Type dtype,
                                            const size_t elementSize,
-                                           const std::vector<size_t>& shape)
+                                           const std::vector<size_t>& shape,
+                                           const bool fortranOrder=false,
+                                           const size_t alignment=16,
+                                           const size_t headerSize=0)
 {
+    if(alignment==0)
+        throw std::runtime_error("The alignment of the npy data must be greater than 0");
+    if(alignment>NPY_MAX_ALIGNMENT)
+        throw std::runtime_error("The alignment of the npy data can not exceed "+std::to_string(NPY_MAX_ALIGNMENT)+" bytes");
+
     size_t ndims = shape.size();
 
     std::string dict;
@@ -182,85 +444,121 @@ static std::vector<char> create_npy_header(const cnpy::Type dtype,
     dict += BigEndianTest();
     dict += map_type(dtype);
     dict += tostring(elementSize);
-    dict += "', 'fortran_order': False, 'shape': (";
+    dict += "', 'fortran_order': ";
+    dict += fortranOrder ? "True" : "False";
+    dict += ", 'shape': (";
     dict += tostring(shape[0]);
     for(int i=1; i<ndims; i++)
         dict += ", " + tostring(shape[i]);
     if(ndims == 1)
         dict += ",";
     dict += "), }";
-    //pad with spaces so that preamble+dict is modulo 16 bytes. preamble is 10 bytes. dict needs to end with \n
-    int remainder = 16 - (10 + dict.size()) % 16;
-    //dict.insert(dict.end(), remainder, ' ');
-    for(int i=0; i<remainder-1; ++i)
-        dict += ' ';
-    dict += '\n';
 
-    NpHeader header;
-    header.dictSize = dict.size();
+    //pad with spaces so that preamble+dict is a multiple of alignment. dict needs to end with \n
+    size_t preambleSize = sizeof(NpHeader);
+    size_t totalSize = headerSize;
+    if(totalSize==0)
+        totalSize = (preambleSize + dict.size() + 1 + alignment - 1) / alignment * alignment;
+    if(totalSize-preambleSize>0xFFFF)
+    {
+        preambleSize = NPY_PREAMBLE_V2_SIZE;
+        if(headerSize==0)
+            totalSize = (preambleSize + dict.size() + 1 + alignment - 1) / alignment * alignment;
+    }
+    if(totalSize<preambleSize+dict.size()+1)
+        return std::vector<char>();
+    dict.append(totalSize - preambleSize - dict.size() - 1, ' ');
+    dict += '\n';
 
     std::vector<char> bytes;
-    bytes.resize(sizeof(NpHeader) + dict.size());
-    std::memcpy(bytes.data(), &header, sizeof(NpHeader));
-    std::memcpy(bytes.data()+sizeof(NpHeader), dict.data(), dict.size());
+    bytes.resize(preambleSize + dict.size());
+    if(preambleSize==sizeof(NpHeader))
+    {
+        NpHeader header;
+        header.dictSize = dict.size();
+        std::memcpy(bytes.data(), &header, sizeof(NpHeader));
+    }
+    else
+    {
+        NpHeader header;
+        header.majorVersion = 0x02;
+        std::memcpy(bytes.data(), &header, NPY_MAGIC_SIZE);
+        const uint32_t dictSize = dict.size();
+        for(int i=0; i<4; ++i)
+            bytes[NPY_MAGIC_SIZE+i] = char((dictSize >> (8*i)) & 0xFF);
+    }
+    std::memcpy(bytes.data()+preambleSize, dict.data(), dict.size());
 
     return bytes;
 }
 
 
-static void parse_npy_header(std::FILE* fp, size_t& word_size, std::vector<size_t>& shape, bool& fortran_order)
+/**
+ * @brief Size of the preamble of a npy file, made of magic string, version and dict length
+ * @param magic The first 8 bytes of the file
+ * @return 10 for version 1.0 files, 12 for version 2.0 and 3.0 files
+ * @throws std::runtime_error If the magic string or the version are not valid
+ */
+static size_t npyPreambleSize(const unsigned char* magic)
 {
-    char buffer[256];
-    size_t res = std::fread(buffer, sizeof(char), 11, fp);
-    if(res != 11)
-        throw std::runtime_error("parse_npy_header: failed fread");
-    const std::string header = std::fgets(buffer, 256, fp);
-    assert(header[header.size()-1] == '\n');
-
-    int loc1, loc2;
+    if(magic[0]!=0x93 || std::memcmp(magic+1, "NUMPY", 5)!=0)
+        throw std::runtime_error("Invalid npy magic string");
 
-    //fortran order
-    loc1 = header.find("fortran_order")+16;
-    fortran_order = (header.substr(loc1,5) == "True" ? true : false);
-
-    //shape
-    loc1 = header.find("(");
-    loc2 = header.find(")");
-    std::string str_shape = header.substr(loc1+1,loc2-loc1-1);
-    int ndims = 0;
-    if(str_shape[str_shape.size()-1] == ',')
-        ndims = 1;
-    else
-        ndims = std::count(str_shape.begin(), str_shape.end(), ',') + 1;
-    shape.resize(ndims);
-    for(int i = 0;i < ndims; i++)
+    switch (magic[6])
     {
-        loc1 = str_shape.find(",");
-        shape[i] = std::stoull(str_shape.substr(0, loc1));
-        str_shape = str_shape.substr(loc1+1);
+    case 1: return sizeof(NpHeader);
+    case 2:
+    case 3: return NPY_PREAMBLE_V2_SIZE;
+    default:
+        throw std::runtime_error("Unsupported npy format version "+std::to_string(int(magic[6])));
     }
+}
+
+/**
+ * @brief Length of the dict stored in a npy preamble of `preambleSize` bytes
+ */
+static size_t npyDictSize(const unsigned char* preamble, const size_t preambleSize)
+{
+    if(preambleSize==sizeof(NpHeader))
+        return readLE16(preamble+NPY_MAGIC_SIZE);
+    return readLE32(preamble+NPY_MAGIC_SIZE);
+}
+
+/**
+ * @brief Read the dict of a npy file from a stream
+ * @param read Function reading `len` bytes into a buffer, returns the number of bytes read
+ * @return The dict string; `headerSize` receives the size of preamble plus dict
+ */
+template<typename _ReadFn>
+static std::string readNpyDict(_ReadFn read, size_t& headerSize)
+{
+    unsigned char preamble[NPY_PREAMBLE_V2_SIZE];
+    if(read(preamble, sizeof(NpHeader))!=sizeof(NpHeader))
+        throw std::runtime_error("Error reading npy header");
 
-    //endian, word size, data type
-    //byte order code | stands for not applicable.
-    //not sure when this applies except for byte array
-    loc1 = header.find("descr")+9;
-    bool littleEndian = header[loc1] == '<' || header[loc1] == '|';//;) // ? true : false);
-    assert(littleEndian);
+    const size_t preambleSize = npyPreambleSize(preamble);
+    const size_t extra = preambleSize - sizeof(NpHeader);
+    if(extra>0 && read(preamble+sizeof(NpHeader), extra)!=extra)
+        throw std::runtime_error("Error reading npy header");
 
-    //char type = header[loc1+1];
+    const size_t dictSize = npyDictSize(preamble, preambleSize);
+    std::string dict;
+    dict.resize(dictSize, ' ');
+    if(read(&dict[0], dictSize)!=dictSize)
+        throw std::runtime_error("Error reading npy dict header");
 
-    std::string str_ws = header.substr(loc1+2);
-    loc2 = str_ws.find("'");
-    word_size = std::stoull(str_ws.substr(0,loc2));
+    headerSize = preambleSize + dictSize;
+    return dict;
 }
 
+
 static void parseDictHeader(const std::string& dict, size_t& word_size, std::vector<size_t>& shape, bool& fortran_order, char& elType)
 {
     int loc1, loc2;
 
     //fortran order
     loc1 = dict.find("fortran_order") + 16;
-    fortran_order = dict.substr(loc1, 5) == "True";
+    fortran_order = dict.compare(loc1, 4, "True")==0;
 
     //shape
     loc1 = dict.find("(");
@@ -293,29 +591,72 @@ static void parseDictHeader(const std::string& dict, size_t& word_size, std::vec
 }
 
 
+/**
+ * @brief Parse the npy header at the beginning of a memory buffer
+ * @param buffer Bytes of the npy file
+ * @param size Number of bytes available in `buffer`
+ * @return The offset of the array data from the beginning of `buffer`
+ * @throws std::runtime_error If the buffer does not start with a valid npy header
+ */
+static size_t parseNpyBuffer(const unsigned char* buffer, const size_t size,
+                             size_t& word_size, std::vector<size_t>& shape, bool& fortran_order, char& elType)
+{
+    if(size<sizeof(NpHeader))
+        throw std::runtime_error("Error reading npy header");
+    const size_t preambleSize = npyPreambleSize(buffer);
+    if(size<preambleSize)
+        throw std::runtime_error("Error reading npy header");
+
+    const size_t dictSize = npyDictSize(buffer, preambleSize);
+    const size_t dataOffset = preambleSize + dictSize;
+    if(size<dataOffset)
+        throw std::runtime_error("Error reading npy dict header");
+
+    const std::string dict(reinterpret_cast<const char*>(buffer)+preambleSize, dictSize);
+    parseDictHeader(dict, word_size, shape, fortran_order, elType);
+
+    return dataOffset;
+}
+
+
+/**
+ * @brief Read the header of a npy file with positional reads
+ * @return The offset of the array data in the file
+ */
+static uint64_t readNpyHeader(const int fd, const std::string& fname, size_t& word_size,
+                              std::vector<size_t>& shape, bool& fortran_order, char& elType)
+{
+    uint64_t offset = 0;
+    size_t headerSize;
+    const std::string dict = readNpyDict([fd, &fname, &offset](void* buffer, size_t len) {
+        preadAll(fd, buffer, len, offset, fname);
+        offset += len;
+        return len;
+    }, headerSize);
+
+    parseDictHeader(dict, word_size, shape, fortran_order, elType);
+    return headerSize;
+}
+
+
 static cnpy::NpArray load_the_npy_file(Handler<std::FILE>& npyFile)
 {
     std::vector<size_t> shape;
     size_t word_size;
     bool fortran_order;
 
-    NpHeader header;
-    zip_int64_t nread = std::fread(&header, sizeof(NpHeader), 1, npyFile.handle());
-    if(nread != 1)
-         throw std::runtime_error("Error reading npy header");
-
-    std::string dict;
-    dict.resize(header.dictSize, ' ');
-    nread = std::fread(&dict[0], sizeof(char), header.dictSize, npyFile.handle());
-    if(nread != header.dictSize)
-         throw std::runtime_error("Error reading npy dict header");
+    size_t headerSize;
+    std::FILE* fp = npyFile.handle();
+    const std::string dict = readNpyDict([fp](void* buffer, size_t len) {
+        return std::fread(buffer, sizeof(char), len, fp);
+    }, headerSize);
 
     char elType;
     parseDictHeader(dict, word_size, shape, fortran_order, elType);
 
     cnpy::NpArray arr(shape, word_size, descr2Type(elType, word_size), fortran_order);
 
-    nread = std::fread(arr.data(), arr.elemSize(), arr.numElements(), npyFile.handle());
+    size_t nread = std::fread(arr.data(), arr.elemSize(), arr.numElements(), fp);
     if(nread != arr.numElements())
         throw std::runtime_error("npy file read error: expected "+std::to_string(arr.numElements())+", read "+std::to_string(nread));
 
@@ -323,257 +664,3929 @@ static cnpy::NpArray load_the_npy_file(Handler<std::FILE>& npyFile)
 }
 
 
-static cnpy::NpArray load_the_npy_file(Handler<struct zip_file>& zipFile)
-{
-    std::vector<size_t> shape;
-    size_t word_size;
-    bool fortran_order;
+static const uint32_t ZIP_LOCAL_HEADER_SIGNATURE = 0x04034b50;
+static const uint32_t ZIP_CENTRAL_HEADER_SIGNATURE = 0x02014b50;
+static const uint32_t ZIP_END_OF_CENTRAL_DIR_SIGNATURE = 0x06054b50;
+static const uint32_t ZIP64_END_OF_CENTRAL_DIR_SIGNATURE = 0x06064b50;
+static const uint32_t ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIGNATURE = 0x07064b50;
+static const uint16_t ZIP64_EXTRA_FIELD_ID = 0x0001;
+static const uint16_t ZIP_ALIGNMENT_EXTRA_FIELD_ID = 0xD935;  //!< Same id used by Android zipalign
+static const uint16_t ZIP_SEEK_EXTRA_FIELD_ID = 0x5343;       //!< "CS", restart points of the entry, private to cnpy
+static const uint16_t ZIP_FILTER_EXTRA_FIELD_ID = 0x4E43;     //!< "CN", filter of the data, private to cnpy
 
-    NpHeader header;
-    zip_int64_t nread = zip_fread(zipFile.handle(), &header, sizeof(NpHeader));
-    if(nread != sizeof(NpHeader))
-         throw std::runtime_error("Error reading npy header in npz file");
+static const size_t ZIP_LOCAL_HEADER_SIZE = 30;
+static const size_t ZIP_CENTRAL_HEADER_SIZE = 46;
+static const size_t ZIP_END_OF_CENTRAL_DIR_SIZE = 22;
+static const size_t ZIP64_END_OF_CENTRAL_DIR_SIZE = 56;
+static const size_t ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE = 20;
 
-    std::string dict;
-    dict.resize(header.dictSize, ' ');
-    nread = zip_fread(zipFile.handle(), &dict[0], header.dictSize);
-    if(nread != header.dictSize)
-         throw std::runtime_error("Error reading npy dict header in npz file");
+static const uint16_t ZIP_METHOD_STORE = 0;
+static const uint16_t ZIP_METHOD_DEFLATE = 8;
+static const uint16_t ZIP_METHOD_ZSTD = 93;
+/** LZ4 frames; APPNOTE assigns no method to lz4, this one is private to cnpy */
+static const uint16_t ZIP_METHOD_LZ4 = 0x4C34;
+/** Filtered entries, private to cnpy; the filter extra field holds the compression method */
+static const uint16_t ZIP_METHOD_FILTERED = 0x4346;
 
-    char elType;
-    parseDictHeader(dict, word_size, shape, fortran_order, elType);
+static const uint16_t ZIP_VERSION_DEFAULT = 20;
+static const uint16_t ZIP_VERSION_ZIP64 = 45;
+static const uint16_t ZIP_VERSION_ZSTD = 63;
+static const uint16_t ZIP_MADE_BY_UNIX = 3 << 8;
+static const uint64_t ZIP32_LIMIT = 0xFFFFFFFF;
+static const size_t ZIP_MAX_ALIGNMENT = 0x8000;
+static const size_t ZIP_COPY_BUFFER_SIZE = 4 << 20;
+/** Most restart points of an entry, so that they fit the 64 KB of extra fields of its central header */
+static const size_t ZIP_MAX_SEEK_POINTS = 4000;
 
-    cnpy::NpArray arr(shape, word_size, descr2Type(elType, word_size), fortran_order);
 
-    nread = zip_fread(zipFile.handle(), arr.data(), arr.size());
-    if(nread != arr.size())
-        throw std::runtime_error("npy file read error: expected "+std::to_string(arr.size())+", read "+std::to_string(nread));
+/**
+ * @brief Restart point of a deflate stream, where decoding can start without the preceding data
+ */
+struct SeekPoint
+{
+    uint64_t uncompressedOffset;    //!< Offset in the uncompressed entry
+    uint64_t compressedOffset;      //!< Offset in the compressed data
+};
 
-    return arr;
-}
+/**
+ * @brief Entry of the central directory of a zip archive.
+ */
+struct ZipEntry
+{
+    std::string name;
+    uint16_t flags;
+    uint16_t method;
+    uint16_t dosTime;
+    uint16_t dosDate;
+    uint32_t crc;
+    uint64_t compressedSize;
+    uint64_t uncompressedSize;
+    uint64_t headerOffset;  //!< Offset of the local file header
+    std::vector<SeekPoint> seekPoints;  //!< Restart points of a deflated entry, relative to its data
+    uint16_t filter = 0;            //!< Filter of the array data: 0 none, 1 shuffle, 2 bit shuffle
+    uint16_t filterElemSize = 0;    //!< Element size used by the filter
+};
 
+/**
+ * @brief Central directory of a zip archive.
+ */
+struct ZipDirectory
+{
+    std::vector<ZipEntry> entries;
+    uint64_t offset;  //!< Offset of the first central directory header
+    uint64_t size;    //!< Size of the central directory
+};
 
-void cnpy::npy_save_data(const std::string& fname,
-                         const unsigned char* data, const Type dtype,
-                         const size_t elemSize, const std::vector<size_t>& shape,
-                         const char mode)
+
+/**
+ * @brief Read the central directory of a zip archive
+ * @param fd Descriptor of the archive
+ * @param fname Name of the archive, used in error messages
+ * @throws std::runtime_error If the archive is not a valid zip file
+ *
+ * Zip64 archives and entries are supported, multi-disk archives are not.
+ */
+static ZipDirectory readZipDirectory(const int fd, const std::string& fname)
 {
-    FILE* fp = NULL;
+    struct stat st;
+    if(::fstat(fd, &st)!=0)
+        throw std::runtime_error("Error reading the size of "+fname);
+    const uint64_t fileSize = st.st_size;
+    if(fileSize<ZIP_END_OF_CENTRAL_DIR_SIZE)
+        throw std::runtime_error(fname+" is not a zip archive");
 
-    if(mode == 'a')
-        fp = fopen(fname.c_str(),"r+b");
+    // The end of central directory record is followed by a comment of at most 65535 bytes
+    const size_t tailSize = std::min<uint64_t>(fileSize, ZIP_END_OF_CENTRAL_DIR_SIZE+0xFFFF);
+    std::vector<unsigned char> tail(tailSize);
+    preadAll(fd, tail.data(), tailSize, fileSize-tailSize, fname);
 
-    if(fp)
+    size_t eocd = tailSize - ZIP_END_OF_CENTRAL_DIR_SIZE + 1;
+    do
     {
-        //file exists. we need to append to it. read the header, modify the array size
-        size_t word_size;
-        std::vector<size_t> tmp_shape;
-        bool fortran_order;
-        parse_npy_header(fp, word_size, tmp_shape, fortran_order);
-        assert(!fortran_order);
+        if(eocd==0)
+            throw std::runtime_error(fname+" is not a zip archive");
+        --eocd;
+    } while(readLE32(&tail[eocd])!=ZIP_END_OF_CENTRAL_DIR_SIGNATURE);
 
-        if(word_size != elemSize)
-            throw std::runtime_error("Attempting to append misdimensioned data to "+fname);
-        if(tmp_shape.size() != shape.size())
-            throw std::runtime_error("Attempting to append misdimensioned data to "+fname);
+    const unsigned char* record = &tail[eocd];
+    if(readLE16(record+4)!=0 || readLE16(record+6)!=0)
+        throw std::runtime_error("Multi-disk zip archives are not supported: "+fname);
 
-        for(int i=1; i<shape.size(); ++i)
-        {
-            if(shape[i] != tmp_shape[i])
-                throw std::runtime_error("Attempting to append misshaped data to "+fname);
-        }
-        tmp_shape[0] += shape[0];
+    ZipDirectory dir;
+    uint64_t numEntries = readLE16(record+10);
+    dir.size = readLE32(record+12);
+    dir.offset = readLE32(record+16);
 
-        fseek(fp, 0, SEEK_SET);
-        std::vector<char> header = create_npy_header(dtype, elemSize, tmp_shape);
-        fwrite(header.data(), sizeof(char), header.size(), fp);
-        fseek(fp, 0, SEEK_END);
-    }
-    else
+    if(numEntries==0xFFFF || dir.size==0xFFFFFFFF || dir.offset==0xFFFFFFFF)
     {
-        fp = fopen(fname.c_str(),"wb");
-        std::vector<char> header = create_npy_header(dtype, elemSize, shape);
-        fwrite(header.data(), sizeof(char), header.size(), fp);
+        const uint64_t eocdOffset = fileSize - tailSize + eocd;
+        if(eocdOffset<ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE)
+            throw std::runtime_error("Missing zip64 end of central directory locator in "+fname);
+
+        unsigned char locator[ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE];
+        preadAll(fd, locator, sizeof(locator), eocdOffset-sizeof(locator), fname);
+        if(readLE32(locator)!=ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIGNATURE)
+            throw std::runtime_error("Missing zip64 end of central directory locator in "+fname);
+
+        unsigned char record64[ZIP64_END_OF_CENTRAL_DIR_SIZE];
+        preadAll(fd, record64, sizeof(record64), readLE64(locator+8), fname);
+        if(readLE32(record64)!=ZIP64_END_OF_CENTRAL_DIR_SIGNATURE)
+            throw std::runtime_error("Invalid zip64 end of central directory in "+fname);
+
+        numEntries = readLE64(record64+32);
+        dir.size = readLE64(record64+40);
+        dir.offset = readLE64(record64+48);
     }
 
-    size_t nels = std::accumulate(shape.cbegin(), shape.cend(), 1U, std::multiplies<size_t>());
-    std::fwrite(data, elemSize, nels, fp);
-    fclose(fp);
-}
+    // zip64 values can make the sum wrap around
+    if(dir.size>fileSize || dir.offset>fileSize-dir.size)
+        throw std::runtime_error("Invalid central directory in "+fname);
 
+    std::vector<unsigned char> cd(dir.size);
+    if(dir.size>0)
+        preadAll(fd, cd.data(), cd.size(), dir.offset, fname);
 
-class ZipSourceCallbackData
-{
-public:
-    ZipSourceCallbackData(const std::vector<char>& h, const unsigned char* d, const size_t dSize):
-        header(h),
-        data(d),
-        dataSize(dSize),
-        offset(0),
-        headerIsDone(false)
-    {}
+    // Do not trust the count of the record further than the directory can hold
+    dir.entries.reserve(std::min<uint64_t>(numEntries, dir.size/ZIP_CENTRAL_HEADER_SIZE));
+    size_t pos = 0;
+    for(uint64_t i=0; i<numEntries; ++i)
+    {
+        if(pos+ZIP_CENTRAL_HEADER_SIZE>cd.size() || readLE32(&cd[pos])!=ZIP_CENTRAL_HEADER_SIGNATURE)
+            throw std::runtime_error("Invalid central directory header in "+fname);
 
-    const std::vector<char>& header;
-    const unsigned char* data;
-    const size_t dataSize;
+        const unsigned char* h = &cd[pos];
+        const size_t nameLen = readLE16(h+28);
+        const size_t extraLen = readLE16(h+30);
+        const size_t commentLen = readLE16(h+32);
+        if(pos+ZIP_CENTRAL_HEADER_SIZE+nameLen+extraLen+commentLen>cd.size())
+            throw std::runtime_error("Invalid central directory header in "+fname);
 
-    size_t offset = 0;
-    bool headerIsDone = false;
-};
+        ZipEntry entry;
+        entry.flags = readLE16(h+8);
+        entry.method = readLE16(h+10);
+        entry.dosTime = readLE16(h+12);
+        entry.dosDate = readLE16(h+14);
+        entry.crc = readLE32(h+16);
+        entry.compressedSize = readLE32(h+20);
+        entry.uncompressedSize = readLE32(h+24);
+        entry.headerOffset = readLE32(h+42);
+        entry.name.assign(reinterpret_cast<const char*>(h+ZIP_CENTRAL_HEADER_SIZE), nameLen);
 
-static zip_int64_t zipSourceCallback(void* userdata, void* data, zip_uint64_t len, zip_source_cmd cmd)
-{
-    ZipSourceCallbackData* cbData = reinterpret_cast<ZipSourceCallbackData*>(userdata);
-    switch (cmd) {
-    case ZIP_SOURCE_OPEN:
-        cbData->offset = 0;
-        cbData->headerIsDone = false;
-        break;
-    case ZIP_SOURCE_READ: {
-        if(cbData->headerIsDone)
+        // Values that do not fit 32 bits are stored in the zip64 extra field, in this order
+        const unsigned char* extra = h + ZIP_CENTRAL_HEADER_SIZE + nameLen;
+        const unsigned char* extraEnd = extra + extraLen;
+        uint16_t filteredMethod = ZIP_METHOD_FILTERED;
+        while(extra+4<=extraEnd)
         {
-            size_t remain = cbData->dataSize-cbData->offset;
-            size_t toCopy = std::min((size_t)len, remain);
-            if(toCopy>0)
-                std::memcpy(data, &cbData->data[cbData->offset], toCopy);
-            cbData->offset += toCopy;
-            return toCopy;
-        }
-        else
-        {
-            size_t remain = cbData->header.size()-cbData->offset;
-            size_t toCopy = std::min((size_t)len, remain);
-            if(toCopy>0)
-                std::memcpy(data, &cbData->header[cbData->offset], toCopy);
-            cbData->offset += toCopy;
-            if(cbData->offset==cbData->header.size())
+            const uint16_t id = readLE16(extra);
+            const uint16_t len = readLE16(extra+2);
+            const unsigned char* field = extra + 4;
+            const unsigned char* fieldEnd = std::min(field+len, extraEnd);
+            if(id==ZIP64_EXTRA_FIELD_ID)
+            {
+                if(entry.uncompressedSize==0xFFFFFFFF && field+8<=fieldEnd)
+                {
+                    entry.uncompressedSize = readLE64(field);
+                    field += 8;
+                }
+                if(entry.compressedSize==0xFFFFFFFF && field+8<=fieldEnd)
+                {
+                    entry.compressedSize = readLE64(field);
+                    field += 8;
+                }
+                if(entry.headerOffset==0xFFFFFFFF && field+8<=fieldEnd)
+                    entry.headerOffset = readLE64(field);
+            }
+            else if(id==ZIP_SEEK_EXTRA_FIELD_ID)
+            {
+                // The points only speed up reads: a malformed list is ignored
+                for(; field+16<=fieldEnd; field+=16)
+                {
+                    const SeekPoint point = {readLE64(field), readLE64(field+8)};
+                    if(!entry.seekPoints.empty() && (point.uncompressedOffset<=entry.seekPoints.back().uncompressedOffset ||
+                                                     point.compressedOffset<=entry.seekPoints.back().compressedOffset))
+                        break;
+                    entry.seekPoints.push_back(point);
+                }
+                if(field!=fieldEnd)
+                    entry.seekPoints.clear();
+            }
+            else if(id==ZIP_FILTER_EXTRA_FIELD_ID && field+6<=fieldEnd)
             {
-                cbData->headerIsDone = true;
-                cbData->offset = 0;
+                entry.filter = readLE16(field);
+                entry.filterElemSize = readLE16(field+2);
+                filteredMethod = readLE16(field+4);
             }
-            return toCopy;
+            extra += 4 + len;
         }
-    }
-    case ZIP_SOURCE_CLOSE:
-        break;
-    case ZIP_SOURCE_STAT: {
-        struct zip_stat* zs = reinterpret_cast<struct zip_stat*>(data);
-        zip_stat_init(zs);
-        zs->encryption_method = ZIP_EM_NONE;
-        zs->size = cbData->dataSize + cbData->header.size(); /* size of file (uncompressed) */
-        zs->mtime = std::time(nullptr);
-        zs->comp_method = ZIP_CM_STORE; /* compression method used */
-        zs->valid = ZIP_STAT_SIZE | ZIP_STAT_MTIME | ZIP_STAT_COMP_METHOD | ZIP_STAT_ENCRYPTION_METHOD;
-        return 0;
-    }
-    case ZIP_SOURCE_ERROR:
-        break;
-    default:
-        break;
+
+        // Filtered entries are written with a private method, so that other
+        // readers refuse them, and their filter field holds the actual one
+        if(entry.method==ZIP_METHOD_FILTERED && entry.filter!=0 &&
+           filteredMethod!=ZIP_METHOD_STORE && filteredMethod!=ZIP_METHOD_FILTERED)
+            entry.method = filteredMethod;
+        else if(entry.method!=ZIP_METHOD_FILTERED)
+            entry.filter = entry.filterElemSize = 0;
+        if(entry.method!=ZIP_METHOD_DEFLATE)
+            entry.seekPoints.clear();
+
+        dir.entries.push_back(entry);
+        pos += ZIP_CENTRAL_HEADER_SIZE + nameLen + extraLen + commentLen;
     }
 
-    return 0;
+    return dir;
 }
 
 
-void cnpy::npz_save_data(const std::string& zipname, const std::string& name,
-                         const unsigned char* data, const cnpy::Type dtype,
-                         const size_t elemSize, const std::vector<size_t>& shape,
-                         const char mode)
+/**
+ * @brief Offset of the data of a zip entry, right after its local header
+ * @throws std::runtime_error If the local header is not valid
+ */
+static uint64_t zipEntryDataOffset(const int fd, const ZipEntry& entry, const std::string& fname)
 {
-    //first, append a .npy to the fname
-    std::string fname(name);
-    fname += ".npy";
+    unsigned char header[ZIP_LOCAL_HEADER_SIZE];
+    preadAll(fd, header, sizeof(header), entry.headerOffset, fname);
+    if(readLE32(header)!=ZIP_LOCAL_HEADER_SIGNATURE)
+        throw std::runtime_error("Invalid local header for "+entry.name+" in "+fname);
 
-    if(mode=='w' && std::ifstream(zipname).is_open())
-    {
-        // Remove the old file if present
-        if(std::remove(zipname.c_str())!=0)
-            throw std::runtime_error("Unable to overwrite "+zipname);
-    }
-
-    Handler<struct zip> zip = zip_open(zipname.c_str(), ZIP_CREATE, nullptr);
-    if(zip.handle()==nullptr)
-        throw std::runtime_error("Error opening npz file "+zipname);
+    return entry.headerOffset + ZIP_LOCAL_HEADER_SIZE + readLE16(header+26) + readLE16(header+28);
+}
 
-    // Remove the old array if present
-    int nameLookup = zip_name_locate(zip.handle(), fname.c_str(), 0);
-    if(nameLookup>=0 && zip_delete(zip.handle(), nameLookup)!=0)
-        throw std::runtime_error("Unable to overwrite "+name+" array");
 
-    std::vector<char> header = create_npy_header(dtype, elemSize, shape);
+/**
+ * @brief Layout of the local header of a zip entry
+ */
+struct ZipLocalLayout
+{
+    uint64_t dataOffset;    //!< Offset of the entry data
+    size_t alignment;       //!< Alignment recorded in the alignment extra field, 0 if missing
+    size_t skew;            //!< Offset in the data of the aligned byte: the npy header size of stored npy entries
+};
 
-    const int dataSize = std::accumulate(shape.cbegin(), shape.cend(), elemSize, std::multiplies<size_t>());
-    ZipSourceCallbackData cbData(header, data, dataSize);
+/**
+ * @brief Read the layout of the local header of a zip entry
+ * @throws std::runtime_error If the local header is not valid
+ */
+static ZipLocalLayout zipLocalLayout(const int fd, const ZipEntry& entry, const std::string& fname)
+{
+    unsigned char header[ZIP_LOCAL_HEADER_SIZE];
+    preadAll(fd, header, sizeof(header), entry.headerOffset, fname);
+    if(readLE32(header)!=ZIP_LOCAL_HEADER_SIGNATURE)
+        throw std::runtime_error("Invalid local header for "+entry.name+" in "+fname);
+    const size_t nameSize = readLE16(header+26);
+    std::vector<unsigned char> extra(readLE16(header+28));
+    if(!extra.empty())
+        preadAll(fd, extra.data(), extra.size(), entry.headerOffset+ZIP_LOCAL_HEADER_SIZE+nameSize, fname);
 
-    Handler<struct zip_source> zipSource = zip_source_function(zip.handle(), zipSourceCallback, &cbData);
-    if(zipSource.handle()==nullptr)
-        throw std::runtime_error("Error creating "+name+" array");
+    ZipLocalLayout layout;
+    layout.dataOffset = entry.headerOffset + ZIP_LOCAL_HEADER_SIZE + nameSize + extra.size();
+    layout.alignment = 0;
+    layout.skew = 0;
+    for(size_t pos=0; pos+6<=extra.size(); pos+=4+readLE16(&extra[pos+2]))
+    {
+        if(readLE16(&extra[pos])==ZIP_ALIGNMENT_EXTRA_FIELD_ID)
+            layout.alignment = readLE16(&extra[pos+4]);
+    }
 
-    zip_int64_t fid = zip_add(zip.handle(), fname.c_str(), zipSource.handle());
-    if(fid<0)
+    if(layout.alignment>1 && entry.method==ZIP_METHOD_STORE && entry.compressedSize>=NPY_PREAMBLE_V2_SIZE)
     {
-        zip_source_free(zipSource.handle());
-        throw std::runtime_error("Error creating "+name+" array");
+        unsigned char preamble[NPY_PREAMBLE_V2_SIZE];
+        preadAll(fd, preamble, sizeof(preamble), layout.dataOffset, fname);
+        try
+        {
+            const size_t preambleSize = npyPreambleSize(preamble);
+            layout.skew = preambleSize + npyDictSize(preamble, preambleSize);
+        }
+        catch(std::runtime_error&)
+        {
+            // Not a npy entry: align the beginning of the data
+        }
     }
 
-    zip.close();
+    return layout;
 }
 
 
-
-cnpy::NpArrayDict cnpy::npz_load(const std::string& fname)
+void cnpy::npy_save_data(const std::string& fname,
+                         const unsigned char* data, const Type dtype,
+                         const size_t elemSize, const std::vector<size_t>& shape,
+                         const char mode, const size_t alignment)
 {
-    Handler<struct zip> zip = zip_open(fname.c_str(), ZIP_CHECKCONS, nullptr);
-    if(zip.handle()==nullptr)
-        throw std::runtime_error("Error opening npz file "+fname);
-
-    NpArrayDict arrays;
-    zip_uint64_t numFiles = zip_get_num_entries(zip.handle(), 0);
-    for(zip_uint64_t fid=0; fid<numFiles; ++fid)
+    if(mode == 'a')
     {
-        const char* arrName = zip_get_name(zip.handle(), fid, 0);
-        if(arrName==nullptr)
-            continue;
+        if(shape.empty())
+            throw std::runtime_error("Can not append a 0-dimensional array to "+fname);
 
-        Handler<struct zip_file> zipFile = zip_fopen_index(zip.handle(), fid, 0);
-
-        std::string name = arrName;
-        name.erase(name.size()-4);
-        arrays.insert(NpArrayDictItem(name, load_the_npy_file(zipFile)));
+        // The writer checks the existing header and only rewrites the shape
+        NpyWriter writer(fname, dtype, elemSize, std::vector<size_t>(shape.begin()+1, shape.end()),
+                         'a', 0, alignment);
+        writer.append(data, shape[0]);
+        writer.close();
+        return;
     }
 
-    return arrays;
+    Handler<std::FILE> fp = fopen(fname.c_str(),"wb");
+    if(fp.handle()==NULL)
+        throw std::runtime_error("Error opening npy file "+fname);
+    std::vector<char> header = create_npy_header(dtype, elemSize, shape, false, alignment);
+    fwrite(header.data(), sizeof(char), header.size(), fp.handle());
+
+    size_t nels = std::accumulate(shape.cbegin(), shape.cend(), 1U, std::multiplies<size_t>());
+    if(std::fwrite(data, elemSize, nels, fp.handle())!=nels)
+        throw std::runtime_error("Error writing npy file "+fname);
 }
 
 
-cnpy::NpArray cnpy::npz_load(const std::string& fname, const std::string& varname)
+cnpy::NpyWriter::NpyWriter(const std::string& fname, const Type dtype, const size_t elemSize,
+                           const std::vector<size_t>& rowShape, const char mode,
+                           const size_t bufferSize, const size_t alignment) :
+    mFname(fname),
+    mFd(-1),
+    mDtype(dtype),
+    mElemSize(elemSize),
+    mAlignment(alignment),
+    mHeaderSize(0),
+    mBufferSize(bufferSize)
 {
-    Handler<struct zip> zip = zip_open(fname.c_str(), ZIP_CHECKCONS, nullptr);
-    if(zip.handle()==nullptr)
-        throw std::runtime_error("Error opening npz file "+fname);
-
-    std::string key = varname + ".npy";
-    int nameLookup = zip_name_locate(zip.handle(), key.c_str(), 0);
-    if(nameLookup<0)
-        throw std::runtime_error("Variable name "+varname+" not found in "+fname);
+    mShape.push_back(0);
+    mShape.insert(mShape.end(), rowShape.begin(), rowShape.end());
+    mRowBytes = std::accumulate(rowShape.begin(), rowShape.end(), elemSize, std::multiplies<size_t>());
 
-    Handler<struct zip_file> zipFile = zip_fopen_index(zip.handle(), nameLookup, 0);
+    if(mode=='a')
+        mFd = ::open(fname.c_str(), O_RDWR);
 
-    NpArray array = load_the_npy_file(zipFile);
-    return array;
-}
+    if(mFd>=0)
+    {
+        try
+        {
+            // Continue the existing array: the header is patched in place as long as it fits
+            std::vector<size_t> shape;
+            size_t word_size;
+            bool fortran_order;
+            char elType;
+            mHeaderSize = readNpyHeader(mFd, fname, word_size, shape, fortran_order, elType);
 
-cnpy::NpArray cnpy::npy_load(const std::string& fname)
-{
-    Handler<std::FILE> fp = std::fopen(fname.c_str(), "r");
+            if(fortran_order)
+                throw std::runtime_error("Can not append rows to the fortran ordered array in "+fname);
+            if(word_size!=elemSize || elType!=map_type(dtype) || shape.size()!=mShape.size())
+                throw std::runtime_error("Attempting to append misdimensioned data to "+fname);
+            if(!std::equal(shape.begin()+1, shape.end(), mShape.begin()+1))
+                throw std::runtime_error("Attempting to append misshaped data to "+fname);
+            mShape[0] = shape[0];
+        }
+        catch(...)
+        {
+            ::close(mFd);
+            throw;
+        }
+    }
+    else
+    {
+        mFd = ::open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if(mFd<0)
+            throw std::runtime_error("Error opening npy file "+fname);
+
+        try
+        {
+            mHeaderSize = reservedHeaderSize();
+            writeHeader();
+        }
+        catch(...)
+        {
+            ::close(mFd);
+            throw;
+        }
+    }
+
+    mDataEnd = mHeaderSize + uint64_t(mShape[0]) * mRowBytes;
+}
+
+cnpy::NpyWriter::~NpyWriter()
+{
+    try
+    {
+        close();
+    }
+    catch(std::exception&)
+    {
+        // Destructors must not throw: call close() to handle errors
+    }
+}
+
+void cnpy::NpyWriter::append(const unsigned char* data, const size_t rows)
+{
+    if(mFd<0)
+        throw std::runtime_error("Attempting to append to the closed npy file "+mFname);
+
+    const size_t size = rows * mRowBytes;
+    if(mBuffer.size()+size>mBufferSize)
+        writeBuffer();
+
+    // Batches larger than the buffer are written as they are
+    if(size>mBufferSize)
+    {
+        pwriteAll(mFd, data, size, mDataEnd, mFname);
+        mDataEnd += size;
+    }
+    else
+        mBuffer.insert(mBuffer.end(), data, data+size);
+
+    mShape[0] += rows;
+}
+
+void cnpy::NpyWriter::flush()
+{
+    if(mFd<0)
+        return;
+
+    writeBuffer();
+    writeHeader();
+}
+
+void cnpy::NpyWriter::close()
+{
+    if(mFd<0)
+        return;
+
+    const int fd = mFd;
+    try
+    {
+        flush();
+    }
+    catch(...)
+    {
+        ::close(fd);
+        mFd = -1;
+        throw;
+    }
+    mFd = -1;
+    if(::close(fd)!=0)
+        throw std::runtime_error("Error closing npy file "+mFname);
+}
+
+size_t cnpy::NpyWriter::reservedHeaderSize() const
+{
+    // Room for the largest number of rows
+    std::vector<size_t> shape = mShape;
+    shape[0] = std::numeric_limits<size_t>::max();
+    return create_npy_header(mDtype, mElemSize, shape, false, mAlignment).size();
+}
+
+void cnpy::NpyWriter::writeBuffer()
+{
+    if(mBuffer.empty())
+        return;
+    pwriteAll(mFd, mBuffer.data(), mBuffer.size(), mDataEnd, mFname);
+    mDataEnd += mBuffer.size();
+    mBuffer.clear();
+}
+
+void cnpy::NpyWriter::writeHeader()
+{
+    std::vector<char> header = create_npy_header(mDtype, mElemSize, mShape, false, mAlignment, mHeaderSize);
+    if(header.empty())
+    {
+        // The shape outgrew the header of an existing file: move the data
+        // once to make room for a header that can hold any number of rows
+        const uint64_t newHeaderSize = reservedHeaderSize();
+        const uint64_t dataSize = mDataEnd - mHeaderSize;
+        std::vector<unsigned char> chunk(std::min<uint64_t>(dataSize, READ_CHUNK_SIZE));
+        for(uint64_t end=dataSize; end>0; )
+        {
+            const uint64_t len = std::min<uint64_t>(end, chunk.size());
+            end -= len;
+            preadAll(mFd, chunk.data(), len, mHeaderSize+end, mFname);
+            pwriteAll(mFd, chunk.data(), len, newHeaderSize+end, mFname);
+        }
+        mHeaderSize = newHeaderSize;
+        mDataEnd = newHeaderSize + dataSize;
+        header = create_npy_header(mDtype, mElemSize, mShape, false, mAlignment, mHeaderSize);
+    }
+
+    pwriteAll(mFd, header.data(), header.size(), 0, mFname);
+}
+
+
+/**
+ * @brief Call `fn(i)` for each i in [0, count) on up to `numThreads` threads
+ *
+ * The indices are handed out in increasing order from a shared counter, so
+ * a thread that finishes early takes the next index. The first exception
+ * thrown by `fn` stops the remaining work and is rethrown.
+ */
+static void parallelFor(const size_t count, const size_t numThreads, const std::function<void(size_t)>& fn)
+{
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    const auto worker = [&]() {
+        for(size_t i=next++; i<count; i=next++)
+        {
+            try
+            {
+                fn(i);
+            }
+            catch(...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if(!error)
+                    error = std::current_exception();
+                next = count;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    try
+    {
+        for(size_t t=1; t<std::min(numThreads, count); ++t)
+            threads.emplace_back(worker);
+    }
+    catch(...)
+    {
+        next = count;
+        for(std::thread& thread: threads)
+            thread.join();
+        throw;
+    }
+
+    worker();
+    for(std::thread& thread: threads)
+        thread.join();
+
+    if(error)
+        std::rethrow_exception(error);
+}
+
+/**
+ * @brief Number of threads to use when `numThreads` threads are requested, 0 meaning one per hardware thread
+ */
+static size_t threadCount(const unsigned numThreads)
+{
+    return numThreads>0 ? numThreads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+
+/**
+ * @brief Update a CRC-32 with buffers larger than the 32 bits length zlib takes
+ */
+static uint32_t crc32Update(uLong crc, const void* data, size_t len)
+{
+    const Bytef* p = reinterpret_cast<const Bytef*>(data);
+    while(len>0)
+    {
+        const uInt chunk = uInt(std::min<size_t>(len, 1u << 30));
+        crc = crc32(crc, p, chunk);
+        p += chunk;
+        len -= chunk;
+    }
+    return uint32_t(crc);
+}
+
+/**
+ * @brief Current local time in MS-DOS format, as stored in zip headers
+ */
+static void zipDosDateTime(uint16_t& dosTime, uint16_t& dosDate)
+{
+    const std::time_t now = std::time(nullptr);
+    std::tm tm;
+    ::localtime_r(&now, &tm);
+    dosTime = uint16_t(tm.tm_hour<<11 | tm.tm_min<<5 | tm.tm_sec/2);
+    dosDate = uint16_t((tm.tm_year-80)<<9 | (tm.tm_mon+1)<<5 | tm.tm_mday);
+}
+
+/**
+ * @brief Version of the zip specification needed to extract `entry`
+ */
+static uint16_t zipVersionNeeded(const ZipEntry& entry, const bool zip64)
+{
+    // The private lz4 method has no version of its own in the zip specification
+    if(entry.method==ZIP_METHOD_ZSTD)
+        return ZIP_VERSION_ZSTD;
+    return zip64 ? ZIP_VERSION_ZIP64 : ZIP_VERSION_DEFAULT;
+}
+
+/**
+ * @brief Compression method written in the headers of `entry`
+ *
+ * Filtered entries get a method of their own: numpy and zip tools then
+ * refuse them instead of returning the filtered bytes.
+ */
+static uint16_t zipHeaderMethod(const ZipEntry& entry)
+{
+    return entry.filter!=0 ? ZIP_METHOD_FILTERED : entry.method;
+}
+
+/**
+ * @brief Build the local file header of `entry`
+ * @param alignment If greater than 1, an alignment extra field is added so
+ *        that byte `skew` of the entry data lands at a multiple of `alignment`
+ * @param forceZip64 Write the sizes in the zip64 extra field even if they fit 32 bits
+ */
+static std::vector<unsigned char> zipLocalHeader(const ZipEntry& entry, const size_t alignment, const size_t skew,
+                                                 const bool forceZip64=false)
+{
+    const bool zip64 = forceZip64 || entry.compressedSize>=ZIP32_LIMIT || entry.uncompressedSize>=ZIP32_LIMIT;
+    const size_t zip64Size = zip64 ? 20 : 0;
+    const size_t filterSize = entry.filter!=0 ? 10 : 0;
+
+    // The alignment field is always written, even when no padding is needed,
+    // so that the alignment is preserved when the entry is moved
+    size_t paddingSize = 0;
+    if(alignment>1)
+    {
+        const uint64_t target = entry.headerOffset + ZIP_LOCAL_HEADER_SIZE + entry.name.size() + zip64Size + filterSize + skew;
+        // The alignment field holds at least its id, its size and the alignment
+        paddingSize = 6;
+        const size_t remainder = (target+paddingSize) % alignment;
+        if(remainder!=0)
+            paddingSize += alignment - remainder;
+    }
+
+    std::vector<unsigned char> header;
+    header.reserve(ZIP_LOCAL_HEADER_SIZE + entry.name.size() + zip64Size + filterSize + paddingSize);
+    writeLE32(header, ZIP_LOCAL_HEADER_SIGNATURE);
+    writeLE16(header, zipVersionNeeded(entry, zip64));
+    writeLE16(header, entry.flags);
+    writeLE16(header, zipHeaderMethod(entry));
+    writeLE16(header, entry.dosTime);
+    writeLE16(header, entry.dosDate);
+    writeLE32(header, entry.crc);
+    writeLE32(header, zip64 ? ZIP32_LIMIT : entry.compressedSize);
+    writeLE32(header, zip64 ? ZIP32_LIMIT : entry.uncompressedSize);
+    writeLE16(header, entry.name.size());
+    writeLE16(header, zip64Size + filterSize + paddingSize);
+    header.insert(header.end(), entry.name.begin(), entry.name.end());
+    if(zip64)
+    {
+        writeLE16(header, ZIP64_EXTRA_FIELD_ID);
+        writeLE16(header, 16);
+        writeLE64(header, entry.uncompressedSize);
+        writeLE64(header, entry.compressedSize);
+    }
+    if(filterSize>0)
+    {
+        writeLE16(header, ZIP_FILTER_EXTRA_FIELD_ID);
+        writeLE16(header, 6);
+        writeLE16(header, entry.filter);
+        writeLE16(header, entry.filterElemSize);
+        writeLE16(header, entry.method);
+    }
+    if(paddingSize>0)
+    {
+        writeLE16(header, ZIP_ALIGNMENT_EXTRA_FIELD_ID);
+        writeLE16(header, paddingSize-4);
+        writeLE16(header, alignment);
+        header.resize(header.size()+paddingSize-6, 0);
+    }
+
+    return header;
+}
+
+/**
+ * @brief Build the central directory header of `entry`
+ */
+static std::vector<unsigned char> zipCentralHeader(const ZipEntry& entry)
+{
+    std::vector<unsigned char> zip64;
+    if(entry.uncompressedSize>=ZIP32_LIMIT)
+        writeLE64(zip64, entry.uncompressedSize);
+    if(entry.compressedSize>=ZIP32_LIMIT)
+        writeLE64(zip64, entry.compressedSize);
+    if(entry.headerOffset>=ZIP32_LIMIT)
+        writeLE64(zip64, entry.headerOffset);
+    const size_t seekSize = entry.seekPoints.empty() ? 0 : 4 + 16*entry.seekPoints.size();
+    const size_t filterSize = entry.filter!=0 ? 10 : 0;
+    const size_t extraSize = (zip64.empty() ? 0 : 4 + zip64.size()) + filterSize + seekSize;
+    const uint16_t version = zipVersionNeeded(entry, !zip64.empty());
+
+    std::vector<unsigned char> header;
+    header.reserve(ZIP_CENTRAL_HEADER_SIZE + entry.name.size() + extraSize);
+    writeLE32(header, ZIP_CENTRAL_HEADER_SIGNATURE);
+    writeLE16(header, ZIP_MADE_BY_UNIX | version);
+    writeLE16(header, version);
+    writeLE16(header, entry.flags);
+    writeLE16(header, zipHeaderMethod(entry));
+    writeLE16(header, entry.dosTime);
+    writeLE16(header, entry.dosDate);
+    writeLE32(header, entry.crc);
+    writeLE32(header, std::min<uint64_t>(entry.compressedSize, ZIP32_LIMIT));
+    writeLE32(header, std::min<uint64_t>(entry.uncompressedSize, ZIP32_LIMIT));
+    writeLE16(header, entry.name.size());
+    writeLE16(header, extraSize);
+    writeLE16(header, 0);    // comment length
+    writeLE16(header, 0);    // disk number
+    writeLE16(header, 0);    // internal attributes
+    writeLE32(header, 0100644u << 16);  // regular file, rw-r--r--
+    writeLE32(header, std::min<uint64_t>(entry.headerOffset, ZIP32_LIMIT));
+    header.insert(header.end(), entry.name.begin(), entry.name.end());
+    if(!zip64.empty())
+    {
+        writeLE16(header, ZIP64_EXTRA_FIELD_ID);
+        writeLE16(header, zip64.size());
+        header.insert(header.end(), zip64.begin(), zip64.end());
+    }
+    if(filterSize>0)
+    {
+        writeLE16(header, ZIP_FILTER_EXTRA_FIELD_ID);
+        writeLE16(header, 6);
+        writeLE16(header, entry.filter);
+        writeLE16(header, entry.filterElemSize);
+        writeLE16(header, entry.method);
+    }
+    if(seekSize>0)
+    {
+        writeLE16(header, ZIP_SEEK_EXTRA_FIELD_ID);
+        writeLE16(header, seekSize-4);
+        for(const SeekPoint& point: entry.seekPoints)
+        {
+            writeLE64(header, point.uncompressedOffset);
+            writeLE64(header, point.compressedOffset);
+        }
+    }
+
+    return header;
+}
+
+/**
+ * @brief Build the end of central directory record, preceded by its zip64 version if needed
+ */
+static std::vector<unsigned char> zipEndOfCentralDirectory(const uint64_t numEntries, const uint64_t offset, const uint64_t size)
+{
+    std::vector<unsigned char> record;
+    const bool zip64 = numEntries>=0xFFFF || offset>=ZIP32_LIMIT || size>=ZIP32_LIMIT;
+    if(zip64)
+    {
+        writeLE32(record, ZIP64_END_OF_CENTRAL_DIR_SIGNATURE);
+        writeLE64(record, ZIP64_END_OF_CENTRAL_DIR_SIZE-12);
+        writeLE16(record, ZIP_MADE_BY_UNIX | ZIP_VERSION_ZIP64);
+        writeLE16(record, ZIP_VERSION_ZIP64);
+        writeLE32(record, 0);
+        writeLE32(record, 0);
+        writeLE64(record, numEntries);
+        writeLE64(record, numEntries);
+        writeLE64(record, size);
+        writeLE64(record, offset);
+
+        writeLE32(record, ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIGNATURE);
+        writeLE32(record, 0);
+        writeLE64(record, offset+size);
+        writeLE32(record, 1);
+    }
+
+    writeLE32(record, ZIP_END_OF_CENTRAL_DIR_SIGNATURE);
+    writeLE16(record, 0);
+    writeLE16(record, 0);
+    writeLE16(record, std::min<uint64_t>(numEntries, 0xFFFF));
+    writeLE16(record, std::min<uint64_t>(numEntries, 0xFFFF));
+    writeLE32(record, std::min<uint64_t>(size, ZIP32_LIMIT));
+    writeLE32(record, std::min<uint64_t>(offset, ZIP32_LIMIT));
+    writeLE16(record, 0);    // comment length
+
+    return record;
+}
+
+
+/**
+ * @brief Bytes of the blocks filtered independently, for elements of `elemSize` bytes
+ *
+ * Blocks hold a multiple of 16 elements, the unit of the SIMD kernels.
+ */
+static size_t filterBlockSize(const size_t elemSize)
+{
+    return std::max<size_t>(FILTER_BLOCK_SIZE/elemSize/16, 1) * 16 * elemSize;
+}
+
+#ifdef __SSE2__
+/**
+ * @brief Interleavings of the 16 x T byte transposition, and the vector left holding each byte plane
+ *
+ * A step interleaves the bytes of the vectors whose index differ by the
+ * given bit: after 4 steps, byte b of 16 consecutive elements of T bytes
+ * ends up in a single vector.
+ */
+static const int SHUFFLE_STEPS_2[4] = {0, 0, 0, 0};
+static const int SHUFFLE_PLANES_2[2] = {0, 1};
+static const int SHUFFLE_STEPS_4[4] = {1, 0, 1, 0};
+static const int SHUFFLE_PLANES_4[4] = {0, 1, 2, 3};
+static const int SHUFFLE_STEPS_8[4] = {2, 1, 0, 2};
+static const int SHUFFLE_PLANES_8[8] = {0, 4, 1, 5, 2, 6, 3, 7};
+
+/**
+ * @brief Byte shuffle of whole groups of 16 elements of T bytes
+ * @return The number of elements shuffled
+ */
+template<size_t T>
+static size_t byteShuffleSse2(const unsigned char* in, unsigned char* out, const size_t n,
+                              const int* steps, const int* planes)
+{
+    const size_t groups = n / 16;
+    for(size_t g=0; g<groups; ++g)
+    {
+        __m128i v[T];
+        for(size_t i=0; i<T; ++i)
+            v[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in+(g*T+i)*16));
+        for(size_t s=0; s<4; ++s)
+        {
+            const size_t bit = size_t(1) << steps[s];
+            for(size_t i=0; i<T; ++i)
+            {
+                if(i & bit)
+                    continue;
+                const __m128i lo = _mm_unpacklo_epi8(v[i], v[i|bit]);
+                v[i|bit] = _mm_unpackhi_epi8(v[i], v[i|bit]);
+                v[i] = lo;
+            }
+        }
+        for(size_t b=0; b<T; ++b)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out+b*n+g*16), v[planes[b]]);
+    }
+    return groups * 16;
+}
+
+/**
+ * @brief Inverse of byteShuffleSse2(), the steps undone in reverse order
+ */
+template<size_t T>
+static size_t byteUnshuffleSse2(const unsigned char* in, unsigned char* out, const size_t n,
+                                const int* steps, const int* planes)
+{
+    const __m128i low = _mm_set1_epi16(0x00FF);
+    const size_t groups = n / 16;
+    for(size_t g=0; g<groups; ++g)
+    {
+        __m128i v[T];
+        for(size_t b=0; b<T; ++b)
+            v[planes[b]] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in+b*n+g*16));
+        for(size_t s=4; s-->0;)
+        {
+            const size_t bit = size_t(1) << steps[s];
+            for(size_t i=0; i<T; ++i)
+            {
+                if(i & bit)
+                    continue;
+                // Even bytes back to the first vector, odd bytes to the second
+                const __m128i even = _mm_packus_epi16(_mm_and_si128(v[i], low), _mm_and_si128(v[i|bit], low));
+                v[i|bit] = _mm_packus_epi16(_mm_srli_epi16(v[i], 8), _mm_srli_epi16(v[i|bit], 8));
+                v[i] = even;
+            }
+        }
+        for(size_t i=0; i<T; ++i)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out+(g*T+i)*16), v[i]);
+    }
+    return groups * 16;
+}
+#endif
+
+/**
+ * @brief Gather byte b of the `n` elements of `in` into the plane `out + b*n`, for each b
+ */
+static void byteShuffle(const unsigned char* in, unsigned char* out, const size_t n, const size_t elemSize)
+{
+    size_t done = 0;
+#ifdef __SSE2__
+    if(elemSize==2)
+        done = byteShuffleSse2<2>(in, out, n, SHUFFLE_STEPS_2, SHUFFLE_PLANES_2);
+    else if(elemSize==4)
+        done = byteShuffleSse2<4>(in, out, n, SHUFFLE_STEPS_4, SHUFFLE_PLANES_4);
+    else if(elemSize==8)
+        done = byteShuffleSse2<8>(in, out, n, SHUFFLE_STEPS_8, SHUFFLE_PLANES_8);
+#endif
+    for(size_t e=done; e<n; ++e)
+        for(size_t b=0; b<elemSize; ++b)
+            out[b*n+e] = in[e*elemSize+b];
+}
+
+/**
+ * @brief Inverse of byteShuffle()
+ */
+static void byteUnshuffle(const unsigned char* in, unsigned char* out, const size_t n, const size_t elemSize)
+{
+    size_t done = 0;
+#ifdef __SSE2__
+    if(elemSize==2)
+        done = byteUnshuffleSse2<2>(in, out, n, SHUFFLE_STEPS_2, SHUFFLE_PLANES_2);
+    else if(elemSize==4)
+        done = byteUnshuffleSse2<4>(in, out, n, SHUFFLE_STEPS_4, SHUFFLE_PLANES_4);
+    else if(elemSize==8)
+        done = byteUnshuffleSse2<8>(in, out, n, SHUFFLE_STEPS_8, SHUFFLE_PLANES_8);
+#endif
+    for(size_t e=done; e<n; ++e)
+        for(size_t b=0; b<elemSize; ++b)
+            out[e*elemSize+b] = in[b*n+e];
+}
+
+/**
+ * @brief Split each of the `numPlanes` planes of `n` bytes into 8 planes of bits
+ *
+ * Bit k of the bytes of plane p goes to the plane 8*p+k of n/8 bytes,
+ * least significant bit first. `n` is a multiple of 16.
+ */
+static void bitTranspose(const unsigned char* in, unsigned char* out, const size_t n, const size_t numPlanes)
+{
+    const size_t bitPlaneSize = n / 8;
+    for(size_t p=0; p<numPlanes; ++p)
+    {
+        const unsigned char* plane = in + p*n;
+        unsigned char* bits = out + p*8*bitPlaneSize;
+#ifdef __SSE2__
+        for(size_t g=0; g<n/16; ++g)
+        {
+            // The mask collects the most significant bit of the 16 bytes
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(plane+g*16));
+            for(size_t k=8; k-->0;)
+            {
+                const int mask = _mm_movemask_epi8(x);
+                bits[k*bitPlaneSize+2*g] = mask & 0xFF;
+                bits[k*bitPlaneSize+2*g+1] = mask >> 8;
+                x = _mm_slli_epi16(x, 1);
+            }
+        }
+#else
+        for(size_t g=0; g<bitPlaneSize; ++g)
+        {
+            for(size_t k=0; k<8; ++k)
+            {
+                unsigned char byte = 0;
+                for(size_t e=0; e<8; ++e)
+                    byte |= ((plane[g*8+e] >> k) & 1) << e;
+                bits[k*bitPlaneSize+g] = byte;
+            }
+        }
+#endif
+    }
+}
+
+/**
+ * @brief Inverse of bitTranspose()
+ */
+static void bitUntranspose(const unsigned char* in, unsigned char* out, const size_t n, const size_t numPlanes)
+{
+    const size_t bitPlaneSize = n / 8;
+#ifdef __SSE2__
+    const __m128i select = _mm_set_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+#endif
+    for(size_t p=0; p<numPlanes; ++p)
+    {
+        const unsigned char* bits = in + p*8*bitPlaneSize;
+        unsigned char* plane = out + p*n;
+#ifdef __SSE2__
+        for(size_t g=0; g<n/16; ++g)
+        {
+            // Byte e of the group takes bit e of the 16 bits of each bit plane
+            __m128i x = _mm_setzero_si128();
+            for(size_t k=0; k<8; ++k)
+            {
+                const __m128i spread = _mm_unpacklo_epi64(_mm_set1_epi8(bits[k*bitPlaneSize+2*g]),
+                                                          _mm_set1_epi8(bits[k*bitPlaneSize+2*g+1]));
+                const __m128i set = _mm_cmpeq_epi8(_mm_and_si128(spread, select), select);
+                x = _mm_or_si128(x, _mm_and_si128(set, _mm_set1_epi8(1 << k)));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(plane+g*16), x);
+        }
+#else
+        for(size_t g=0; g<bitPlaneSize; ++g)
+        {
+            for(size_t e=0; e<8; ++e)
+            {
+                unsigned char byte = 0;
+                for(size_t k=0; k<8; ++k)
+                    byte |= ((bits[k*bitPlaneSize+g] >> e) & 1) << k;
+                plane[g*8+e] = byte;
+            }
+        }
+#endif
+    }
+}
+
+/**
+ * @brief Filter a block of `n` elements of `elemSize` bytes
+ * @param scratch Room for the block, used by the bit shuffle
+ *
+ * The bit shuffle covers whole groups of 16 elements, the bytes of the
+ * remaining elements are kept as is after them.
+ */
+static void filterBlock(const cnpy::Filter filter, const size_t elemSize, const unsigned char* in,
+                        const size_t n, unsigned char* out, unsigned char* scratch)
+{
+    if(filter==cnpy::Filter::Shuffle)
+    {
+        byteShuffle(in, out, n, elemSize);
+        return;
+    }
+
+    const size_t n16 = n & ~size_t(15);
+    byteShuffle(in, scratch, n16, elemSize);
+    bitTranspose(scratch, out, n16, elemSize);
+    std::memcpy(out+n16*elemSize, in+n16*elemSize, (n-n16)*elemSize);
+}
+
+/**
+ * @brief Inverse of filterBlock()
+ */
+static void unfilterBlock(const cnpy::Filter filter, const size_t elemSize, const unsigned char* in,
+                          const size_t n, unsigned char* out, unsigned char* scratch)
+{
+    if(filter==cnpy::Filter::Shuffle)
+    {
+        byteUnshuffle(in, out, n, elemSize);
+        return;
+    }
+
+    const size_t n16 = n & ~size_t(15);
+    bitUntranspose(in, scratch, n16, elemSize);
+    byteUnshuffle(scratch, out, n16, elemSize);
+    std::memcpy(out+n16*elemSize, in+n16*elemSize, (n-n16)*elemSize);
+}
+
+/**
+ * @brief Round the mantissas of `size` bytes of IEEE floats of `floatSize` bytes to `bits` bits
+ *
+ * Rounding is to nearest, ties to even, as numcodecs' BitRound does. NaNs
+ * and infinities are kept, and values that would round up to infinity are
+ * truncated instead.
+ */
+static void roundMantissas(const unsigned char* in, unsigned char* out, const size_t size,
+                           const size_t floatSize, const int bits)
+{
+    size_t done = 0;
+    if(floatSize==4)
+    {
+        const uint32_t shift = 23 - bits;
+        const uint32_t half = (uint32_t(1) << (shift-1)) - 1;
+        const uint32_t mask = ~((uint32_t(1) << shift) - 1);
+        const uint32_t exponent = 0x7F800000;
+#ifdef __SSE2__
+        const __m128i vHalf = _mm_set1_epi32(half);
+        const __m128i vMask = _mm_set1_epi32(mask);
+        const __m128i vExponent = _mm_set1_epi32(exponent);
+        const __m128i one = _mm_set1_epi32(1);
+        for(; done+16<=size; done+=16)
+        {
+            const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in+done));
+            const __m128i odd = _mm_and_si128(_mm_srli_epi32(x, shift), one);
+            const __m128i rounded = _mm_and_si128(_mm_add_epi32(x, _mm_add_epi32(vHalf, odd)), vMask);
+            const __m128i special = _mm_cmpeq_epi32(_mm_and_si128(x, vExponent), vExponent);
+            const __m128i overflow = _mm_cmpeq_epi32(_mm_and_si128(rounded, vExponent), vExponent);
+            const __m128i finite = _mm_or_si128(_mm_and_si128(overflow, _mm_and_si128(x, vMask)),
+                                                _mm_andnot_si128(overflow, rounded));
+            const __m128i y = _mm_or_si128(_mm_and_si128(special, x), _mm_andnot_si128(special, finite));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out+done), y);
+        }
+#endif
+        for(; done+4<=size; done+=4)
+        {
+            uint32_t x;
+            std::memcpy(&x, in+done, 4);
+            uint32_t y = x;
+            if((x & exponent)!=exponent)
+            {
+                y = (x + half + ((x >> shift) & 1)) & mask;
+                if((y & exponent)==exponent)
+                    y = x & mask;
+            }
+            std::memcpy(out+done, &y, 4);
+        }
+    }
+    else
+    {
+        const uint64_t shift = 52 - bits;
+        const uint64_t half = (uint64_t(1) << (shift-1)) - 1;
+        const uint64_t mask = ~((uint64_t(1) << shift) - 1);
+        const uint64_t exponent = 0x7FF0000000000000ull;
+#ifdef __SSE2__
+        const __m128i vHalf = _mm_set1_epi64x(half);
+        const __m128i vMask = _mm_set1_epi64x(mask);
+        const __m128i vExponent = _mm_set1_epi64x(exponent);
+        const __m128i one = _mm_set1_epi64x(1);
+        // SSE2 has no 64 bits comparison: the exponent is all in the high half
+        const auto highEqual = [](const __m128i a, const __m128i b) {
+            return _mm_shuffle_epi32(_mm_cmpeq_epi32(a, b), _MM_SHUFFLE(3, 3, 1, 1));
+        };
+        for(; done+16<=size; done+=16)
+        {
+            const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in+done));
+            const __m128i odd = _mm_and_si128(_mm_srli_epi64(x, shift), one);
+            const __m128i rounded = _mm_and_si128(_mm_add_epi64(x, _mm_add_epi64(vHalf, odd)), vMask);
+            const __m128i special = highEqual(_mm_and_si128(x, vExponent), vExponent);
+            const __m128i overflow = highEqual(_mm_and_si128(rounded, vExponent), vExponent);
+            const __m128i finite = _mm_or_si128(_mm_and_si128(overflow, _mm_and_si128(x, vMask)),
+                                                _mm_andnot_si128(overflow, rounded));
+            const __m128i y = _mm_or_si128(_mm_and_si128(special, x), _mm_andnot_si128(special, finite));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out+done), y);
+        }
+#endif
+        for(; done+8<=size; done+=8)
+        {
+            uint64_t x;
+            std::memcpy(&x, in+done, 8);
+            uint64_t y = x;
+            if((x & exponent)!=exponent)
+            {
+                y = (x + half + ((x >> shift) & 1)) & mask;
+                if((y & exponent)==exponent)
+                    y = x & mask;
+            }
+            std::memcpy(out+done, &y, 8);
+        }
+    }
+    std::memcpy(out+done, in+done, size-done);
+}
+
+/**
+ * @brief Largest absolute difference between `size` bytes of floats and their rounded values
+ */
+static double mantissaRoundingError(const unsigned char* data, const unsigned char* rounded,
+                                    const size_t size, const size_t floatSize)
+{
+    double error = 0;
+    for(size_t i=0; i+floatSize<=size; i+=floatSize)
+    {
+        double x, y;
+        if(floatSize==4)
+        {
+            float a, b;
+            std::memcpy(&a, data+i, 4);
+            std::memcpy(&b, rounded+i, 4);
+            x = a;
+            y = b;
+        }
+        else
+        {
+            std::memcpy(&x, data+i, 8);
+            std::memcpy(&y, rounded+i, 8);
+        }
+        // NaNs compare false and are skipped
+        if(std::fabs(x-y)>error && std::isfinite(x))
+            error = std::fabs(x-y);
+    }
+    return error;
+}
+
+/**
+ * @brief Largest error of the mantissa rounding of an entry
+ *
+ * Shared by the copies of its FilteredData, which may round blocks on
+ * several threads.
+ */
+class RoundingError
+{
+public:
+    RoundingError() : mMax(0) {}
+
+    void raise(const double error)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mMax = std::max(mMax, error);
+    }
+
+    double max() const { return mMax; }
+
+private:
+    std::mutex mMutex;
+    double mMax;
+};
+
+/**
+ * @brief Size of the floats whose mantissas can be rounded in arrays of `dtype`, 0 for other types
+ */
+static size_t floatComponentSize(const cnpy::Type dtype, const size_t elemSize)
+{
+    switch(dtype)
+    {
+    case cnpy::Type::Float:
+    case cnpy::Type::Double:
+        return elemSize==4 || elemSize==8 ? elemSize : 0;
+    case cnpy::Type::ComplexFloat:
+    case cnpy::Type::ComplexDouble:
+        return elemSize==8 || elemSize==16 ? elemSize/2 : 0;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Mantissa bits to round floats of `floatSize` bytes to, -1 when rounding changes nothing
+ */
+static int mantissaRoundingBits(const size_t floatSize, const int mantissaBits)
+{
+    const int available = floatSize==4 ? 23 : floatSize==8 ? 52 : 0;
+    return mantissaBits>=0 && mantissaBits<available ? mantissaBits : -1;
+}
+
+/**
+ * @brief The data of an entry as written in the archive, rounded and filtered a few blocks at a time
+ *
+ * Each block of filterBlockSize() bytes is transformed independently, so
+ * that any range of the written data can be produced without the whole array.
+ */
+class FilteredData
+{
+public:
+    /**
+     * @param floatSize Size of the floats whose mantissas are rounded
+     * @param mantissaBits Mantissa bits kept, -1 to leave the data as is
+     * @param error If not null, raised to the error of the blocks as they are rounded
+     */
+    FilteredData(const unsigned char* data, const size_t size, const cnpy::Filter filter, const size_t elemSize,
+                 const size_t floatSize=0, const int mantissaBits=-1, RoundingError* error=nullptr) :
+        mData(data),
+        mSize(size),
+        mFilter(filter),
+        mElemSize(elemSize),
+        mFloatSize(floatSize),
+        mMantissaBits(mantissaBits),
+        mError(error),
+        mBlockSize(filter==cnpy::Filter::None && mantissaBits<0 ? 0 : filterBlockSize(elemSize)),
+        mBegin(0),
+        mEnd(0)
+    {}
+
+    size_t size() const { return mSize; }
+    cnpy::Filter filter() const { return mFilter; }
+    size_t elemSize() const { return mElemSize; }
+
+    /**
+     * @brief Bytes [begin, end) of the transformed data, valid until the next call
+     */
+    const unsigned char* get(const size_t begin, const size_t end)
+    {
+        if(mBlockSize==0)
+            return mData + begin;
+
+        if(begin<mBegin || end>mEnd)
+        {
+            mBegin = begin / mBlockSize * mBlockSize;
+            mEnd = std::min((end+mBlockSize-1) / mBlockSize * mBlockSize, mSize);
+            mBuffer.resize(mEnd-mBegin);
+            mScratch.resize(mBlockSize);
+            if(mMantissaBits>=0 && mFilter!=cnpy::Filter::None)
+                mRounded.resize(mBlockSize);
+            double error = 0;
+            for(size_t block=mBegin; block<mEnd; block+=mBlockSize)
+            {
+                const size_t len = std::min(mBlockSize, mEnd-block);
+                const unsigned char* input = mData + block;
+                unsigned char* output = &mBuffer[block-mBegin];
+                if(mMantissaBits>=0)
+                {
+                    unsigned char* rounded = mFilter==cnpy::Filter::None ? output : mRounded.data();
+                    roundMantissas(input, rounded, len, mFloatSize, mMantissaBits);
+                    if(mError!=nullptr)
+                        error = std::max(error, mantissaRoundingError(input, rounded, len, mFloatSize));
+                    input = rounded;
+                }
+                if(mFilter!=cnpy::Filter::None)
+                    filterBlock(mFilter, mElemSize, input, len/mElemSize, output, mScratch.data());
+            }
+            if(mError!=nullptr)
+                mError->raise(error);
+        }
+        return mBuffer.data() + (begin-mBegin);
+    }
+
+private:
+    const unsigned char* mData;
+    size_t mSize;
+    cnpy::Filter mFilter;
+    size_t mElemSize;
+    size_t mFloatSize;
+    int mMantissaBits;
+    RoundingError* mError;
+    size_t mBlockSize;  //!< 0 when the data is written as is
+    size_t mBegin;      //!< Range of the data held transformed in mBuffer
+    size_t mEnd;
+    std::vector<unsigned char> mBuffer;
+    std::vector<unsigned char> mScratch;
+    std::vector<unsigned char> mRounded;
+};
+
+/**
+ * @brief The filter of the data of `entry`
+ */
+static cnpy::Filter zipEntryFilter(const ZipEntry& entry, const std::string& fname)
+{
+    switch(entry.filter)
+    {
+    case 0:
+        return cnpy::Filter::None;
+    case 1:
+    case 2:
+        if(entry.filterElemSize==0)
+            break;
+        return entry.filter==1 ? cnpy::Filter::Shuffle : cnpy::Filter::BitShuffle;
+    default:
+        break;
+    }
+    throw std::runtime_error("Unsupported filter for "+entry.name+" in "+fname);
+}
+
+/**
+ * @brief Undo the filter of `size` bytes of data of `entry`, in place
+ */
+static void unfilterNpzData(const ZipEntry& entry, unsigned char* data, const size_t size, const std::string& fname)
+{
+    const cnpy::Filter filter = zipEntryFilter(entry, fname);
+    if(filter==cnpy::Filter::None)
+        return;
+
+    const size_t blockSize = filterBlockSize(entry.filterElemSize);
+    std::vector<unsigned char> block(std::min(blockSize, size));
+    std::vector<unsigned char> scratch(block.size());
+    for(size_t begin=0; begin<size; begin+=blockSize)
+    {
+        const size_t len = std::min(blockSize, size-begin);
+        unfilterBlock(filter, entry.filterElemSize, data+begin, len/entry.filterElemSize, block.data(), scratch.data());
+        std::memcpy(data+begin, block.data(), len);
+    }
+}
+
+/**
+ * @brief Compress `prefix` followed by `data` as a piece of a raw deflate stream
+ * @param dictionary The bytes preceding `data` in the stream, used to prime the encoder
+ * @param last Whether the piece ends the stream; otherwise it ends with a sync
+ *        flush, on a byte boundary, so that the next piece can be appended
+ */
+static void deflateBlock(const std::vector<char>& prefix, const unsigned char* data, const size_t size,
+                         const unsigned char* dictionary, const size_t dictionarySize,
+                         const int level, const bool last, std::vector<unsigned char>& output,
+                         const std::string& name)
+{
+    z_stream stream;
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+    if(deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY)!=Z_OK)
+        throw std::runtime_error("Error initializing the encoder for "+name);
+    std::unique_ptr<z_stream, int(*)(z_stream*)> streamGuard(&stream, deflateEnd);
+
+    if(dictionarySize>0 && deflateSetDictionary(&stream, dictionary, dictionarySize)!=Z_OK)
+        throw std::runtime_error("Error initializing the encoder for "+name);
+
+    output.resize(deflateBound(&stream, prefix.size()+size) + DEFLATE_BLOCK_OVERHEAD);
+    stream.next_out = output.data();
+    stream.avail_out = std::min<size_t>(output.size(), std::numeric_limits<uInt>::max());
+
+    // zlib before 1.2.9 reports Z_BUF_ERROR for a call without input, so
+    // the empty prefix of the blocks after the first is not passed at all
+    if(!prefix.empty())
+    {
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(prefix.data()));
+        stream.avail_in = prefix.size();
+        if(deflate(&stream, Z_NO_FLUSH)!=Z_OK)
+            throw std::runtime_error("Error compressing "+name);
+    }
+
+    // avail_in and avail_out are 32 bits wide: larger blocks take several calls
+    const int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    const Bytef* next = data;
+    size_t left = size;
+    size_t produced = stream.next_out - output.data();
+    for(;;)
+    {
+        const uInt in = std::min<size_t>(left, std::numeric_limits<uInt>::max());
+        const uInt out = std::min<size_t>(output.size()-produced, std::numeric_limits<uInt>::max());
+        stream.next_in = const_cast<Bytef*>(next);
+        stream.avail_in = in;
+        stream.next_out = output.data() + produced;
+        stream.avail_out = out;
+        const int ret = deflate(&stream, in==left ? flush : Z_NO_FLUSH);
+        if(ret!=Z_OK && ret!=Z_STREAM_END)
+            throw std::runtime_error("Error compressing "+name);
+        next += in - stream.avail_in;
+        left -= in - stream.avail_in;
+        produced += out - stream.avail_out;
+        // A sync flush is complete once it leaves room in the output
+        if(left==0 && (last ? ret==Z_STREAM_END : stream.avail_out>0))
+            break;
+        if(produced==output.size())
+            throw std::runtime_error("Error compressing "+name);
+    }
+
+    output.resize(produced);
+}
+
+
+/**
+ * @brief Writer of a zip archive on a file descriptor
+ *
+ * Entries are written one after the other starting from the given offset,
+ * the central directory is written by finish().
+ */
+class cnpy::ZipWriter
+{
+public:
+    ZipWriter(const int fd, const std::string& fname, const uint64_t offset=0):
+        mFd(fd),
+        mFname(fname),
+        mOffset(offset)
+    {}
+
+    /**
+     * @brief Continue an existing archive
+     *
+     * New entries overwrite the old central directory, which is written
+     * again with the new entries by finish().
+     */
+    ZipWriter(const int fd, const std::string& fname, const ZipDirectory& dir):
+        mFd(fd),
+        mFname(fname),
+        mOffset(dir.offset),
+        mEntries(dir.entries)
+    {}
+
+    /**
+     * @brief Write a `npy` entry
+     * @param name Name of the entry
+     * @param header The npy header
+     * @param data The array data, written right after the header
+     * @param dataSize Size in bytes of `data`
+     * @param elemSize Size in bytes of the elements of the array
+     * @param floatSize Size of the floats making the elements, 0 if they are not floats
+     * @param options Compression, rounding and filter of the entry, and alignment of `data` if stored
+     * @param restartInterval Bytes of `data` between the restart points of a
+     *        deflated entry, 0 for none
+     * @param roundingError If not null, raised to the error of the mantissa rounding
+     */
+    void add(const std::string& name, const std::vector<char>& header,
+             const unsigned char* data, const size_t dataSize, const size_t elemSize,
+             const size_t floatSize, const cnpy::NpzSaveOptions& options,
+             const size_t restartInterval=0, RoundingError* roundingError=nullptr)
+    {
+        // Stored arrays are never filtered, so that they stay readable by
+        // numpy and can be mapped; shuffling single bytes changes nothing
+        const bool filtered = options.compression!=cnpy::Compression::None && options.filter!=cnpy::Filter::None &&
+                              elemSize>0 && elemSize<=0xFFFF &&
+                              (options.filter==cnpy::Filter::BitShuffle || elemSize>1);
+        const FilteredData source(data, dataSize, filtered ? options.filter : cnpy::Filter::None, elemSize,
+                                  floatSize, mantissaRoundingBits(floatSize, options.mantissaBits), roundingError);
+
+        switch(options.compression)
+        {
+        case cnpy::Compression::Auto:
+            add(name, header, data, dataSize, elemSize, floatSize, chooseCompression(source, options),
+                restartInterval, roundingError);
+            break;
+        case cnpy::Compression::None:
+            addStored(name, header, source, options.alignment);
+            break;
+        case cnpy::Compression::Deflate:
+            addDeflated(name, header, source, options.level, options.numThreads, restartInterval);
+            break;
+        case cnpy::Compression::Zstd:
+            addZstd(name, header, source, options.level, options.numThreads);
+            break;
+        case cnpy::Compression::Lz4:
+            addLz4(name, header, source, options.level);
+            break;
+        default:
+            throw std::runtime_error("Unsupported compression for "+name+" in "+mFname);
+        }
+    }
+
+    /**
+     * @brief Write a `npy` entry stored without compression
+     * @param alignment Alignment of `data` in the archive, 0 or 1 to disable it
+     */
+    void addStored(const std::string& name, const std::vector<char>& header,
+                   FilteredData source, const size_t alignment)
+    {
+        const size_t dataSize = source.size();
+        ZipEntry entry;
+        entry.name = name;
+        entry.flags = 0;
+        entry.method = ZIP_METHOD_STORE;
+        zipDosDateTime(entry.dosTime, entry.dosDate);
+        entry.crc = 0;
+        entry.compressedSize = header.size() + dataSize;
+        entry.uncompressedSize = entry.compressedSize;
+        entry.headerOffset = mOffset;
+
+        // Local header and npy header go out with a single write. The data
+        // may be rounded: its CRC is computed as it is written, and the
+        // local header, whose size does not depend on it, is written again
+        // at the end
+        std::vector<unsigned char> headers = zipLocalHeader(entry, alignment, header.size());
+        const size_t localHeaderSize = headers.size();
+        headers.insert(headers.end(), header.begin(), header.end());
+        write(headers.data(), headers.size());
+        entry.crc = crc32Update(0, header.data(), header.size());
+        for(size_t begin=0; begin<dataSize; begin+=ENCODER_INPUT_SIZE)
+        {
+            const size_t end = std::min(begin+ENCODER_INPUT_SIZE, dataSize);
+            const unsigned char* input = source.get(begin, end);
+            entry.crc = crc32Update(entry.crc, input, end-begin);
+            write(input, end-begin);
+        }
+
+        headers = zipLocalHeader(entry, alignment, header.size());
+        pwriteAll(mFd, headers.data(), localHeaderSize, entry.headerOffset, mFname);
+
+        mEntries.push_back(entry);
+    }
+
+    /**
+     * @brief Write a `npy` entry compressed with deflate
+     *
+     * The compressed data is streamed to the file as it is produced, the
+     * local header is written last, when the sizes are known.
+     */
+    void addDeflated(const std::string& name, const std::vector<char>& header,
+                     FilteredData source, const int level,
+                     const unsigned numThreads, const size_t restartInterval)
+    {
+        if(level!=Z_DEFAULT_COMPRESSION && (level<Z_BEST_SPEED || level>Z_BEST_COMPRESSION))
+            throw std::runtime_error("Invalid deflate level "+std::to_string(level)+" for "+name);
+
+        const size_t dataSize = source.size();
+        const size_t threads = threadCount(numThreads);
+        if(threads>1 && dataSize>std::min(DEFLATE_BLOCK_SIZE, restartInterval>0 ? restartInterval : DEFLATE_BLOCK_SIZE))
+        {
+            addDeflatedBlocks(name, header, source, level, threads, restartInterval);
+            return;
+        }
+
+        ZipEntry entry;
+        entry.name = name;
+        entry.flags = 0;
+        entry.method = ZIP_METHOD_DEFLATE;
+        zipDosDateTime(entry.dosTime, entry.dosDate);
+        setFilter(entry, source);
+        entry.crc = crc32Update(0, header.data(), header.size());
+        entry.uncompressedSize = header.size() + dataSize;
+        entry.compressedSize = 0;
+        entry.headerOffset = mOffset;
+
+        z_stream stream;
+        stream.zalloc = Z_NULL;
+        stream.zfree = Z_NULL;
+        stream.opaque = Z_NULL;
+        // Negative window bits: raw deflate data, without zlib header
+        if(deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY)!=Z_OK)
+            throw std::runtime_error("Error initializing the encoder for "+name);
+        std::unique_ptr<z_stream, int(*)(z_stream*)> streamGuard(&stream, deflateEnd);
+
+        // The size of the local header depends on whether the compressed size
+        // may need 64 bits: decide it from the worst case
+        const bool zip64 = deflateBound(&stream, entry.uncompressedSize)>=ZIP32_LIMIT ||
+                           entry.uncompressedSize>=ZIP32_LIMIT;
+        mOffset += zipLocalHeader(entry, 0, 0, zip64).size();
+        const uint64_t dataOffset = mOffset;
+
+        std::vector<unsigned char> output(DEFLATE_OUTPUT_SIZE);
+        const auto compress = [&](const void* input, const size_t size, const int flush) {
+            const unsigned char* next = static_cast<const unsigned char*>(input);
+            size_t left = size;
+            int ret;
+            do
+            {
+                // avail_in is 32 bits wide
+                const uInt chunk = std::min<size_t>(left, std::numeric_limits<uInt>::max());
+                stream.next_in = const_cast<Bytef*>(next);
+                stream.avail_in = chunk;
+                const int mode = chunk==left ? flush : Z_NO_FLUSH;
+                do
+                {
+                    stream.next_out = output.data();
+                    stream.avail_out = output.size();
+                    ret = deflate(&stream, mode);
+                    if(ret==Z_STREAM_ERROR)
+                        throw std::runtime_error("Error compressing "+name);
+                    write(output.data(), output.size()-stream.avail_out);
+                } while(stream.avail_out==0);
+                next += chunk;
+                left -= chunk;
+            } while(left>0);
+            return ret;
+        };
+        compress(header.data(), header.size(), Z_NO_FLUSH);
+
+        // A full flush every restartInterval bytes resets the encoder: the
+        // decoder can start again from there without the preceding data
+        const size_t segment = restartInterval>0 ? restartInterval : std::max<size_t>(dataSize, 1);
+        int ret = Z_OK;
+        for(size_t begin=0; begin==0 || begin<dataSize; begin+=segment)
+        {
+            if(begin>0)
+                entry.seekPoints.push_back(SeekPoint{header.size()+begin, mOffset-dataOffset});
+            const size_t end = std::min(begin+segment, dataSize);
+            for(size_t chunk=begin; chunk==begin || chunk<end; chunk+=ENCODER_INPUT_SIZE)
+            {
+                const size_t size = std::min(ENCODER_INPUT_SIZE, end-chunk);
+                const unsigned char* input = source.get(chunk, chunk+size);
+                entry.crc = crc32Update(entry.crc, input, size);
+                ret = compress(input, size, chunk+size<end ? Z_NO_FLUSH : end>=dataSize ? Z_FINISH : Z_FULL_FLUSH);
+            }
+        }
+        if(ret!=Z_STREAM_END)
+            throw std::runtime_error("Error compressing "+name);
+
+        entry.compressedSize = mOffset - dataOffset;
+        const std::vector<unsigned char> localHeader = zipLocalHeader(entry, 0, 0, zip64);
+        pwriteAll(mFd, localHeader.data(), localHeader.size(), entry.headerOffset, mFname);
+
+        mEntries.push_back(entry);
+    }
+
+    /**
+     * @brief Write a `npy` entry compressed with deflate on several threads
+     *
+     * As pigz does, the data is cut into blocks of DEFLATE_BLOCK_SIZE bytes
+     * compressed independently, each one primed with the last 32 KB of the
+     * previous block as dictionary. Every block but the last ends with a
+     * sync flush, so that the blocks concatenated form a single deflate
+     * stream, and the CRC of the entry is combined from those of the blocks.
+     *
+     * With restart points the data is first cut into segments of
+     * restartInterval bytes, and the first block of a segment is compressed
+     * without dictionary, so that the segment can be decoded alone.
+     */
+    void addDeflatedBlocks(const std::string& name, const std::vector<char>& header,
+                           const FilteredData& source, const int level,
+                           const size_t threads, const size_t restartInterval)
+    {
+        const size_t dataSize = source.size();
+        const size_t segment = restartInterval>0 ? restartInterval : dataSize;
+
+        // Offsets of the blocks; those starting a segment are flagged as restarts
+        std::vector<std::pair<size_t, bool>> blocks;
+        for(size_t start=0; start<dataSize; start+=segment)
+            for(size_t begin=start; begin<std::min(start+segment, dataSize); begin+=DEFLATE_BLOCK_SIZE)
+                blocks.push_back(std::make_pair(begin, begin==start));
+        const size_t numBlocks = blocks.size();
+        const auto blockSize = [&](const size_t i) {
+            return (i+1<numBlocks ? blocks[i+1].first : dataSize) - blocks[i].first;
+        };
+
+        ZipEntry entry;
+        entry.name = name;
+        entry.flags = 0;
+        entry.method = ZIP_METHOD_DEFLATE;
+        zipDosDateTime(entry.dosTime, entry.dosDate);
+        setFilter(entry, source);
+        entry.crc = crc32Update(0, header.data(), header.size());
+        entry.uncompressedSize = header.size() + dataSize;
+        entry.compressedSize = 0;
+        entry.headerOffset = mOffset;
+
+        const bool zip64 = deflateBound(Z_NULL, entry.uncompressedSize)+numBlocks*DEFLATE_BLOCK_OVERHEAD>=ZIP32_LIMIT ||
+                           entry.uncompressedSize>=ZIP32_LIMIT;
+        mOffset += zipLocalHeader(entry, 0, 0, zip64).size();
+        const uint64_t dataOffset = mOffset;
+
+        // Blocks are compressed a batch at a time and written in order,
+        // keeping a bounded amount of compressed data in memory
+        const size_t batchSize = threads * 4;
+        std::vector<std::vector<unsigned char>> outputs(batchSize);
+        std::vector<uLong> crcs(batchSize);
+        for(size_t first=0; first<numBlocks; first+=batchSize)
+        {
+            const size_t count = std::min(batchSize, numBlocks-first);
+            parallelFor(count, threads, [&](size_t j) {
+                const size_t i = first + j;
+                const size_t begin = blocks[i].first;
+                const size_t size = blockSize(i);
+                const size_t dictSize = blocks[i].second ? 0 : std::min(begin, DEFLATE_DICTIONARY_SIZE);
+                FilteredData blockSource = source;
+                const unsigned char* input = blockSource.get(begin-dictSize, begin+size);
+                deflateBlock(i==0 ? header : std::vector<char>(), input+dictSize, size,
+                             input, dictSize, level, i+1==numBlocks, outputs[j], name);
+                crcs[j] = crc32Update(0, input+dictSize, size);
+            });
+
+            for(size_t j=0; j<count; ++j)
+            {
+                const size_t i = first + j;
+                if(i>0 && blocks[i].second)
+                    entry.seekPoints.push_back(SeekPoint{header.size()+blocks[i].first, mOffset-dataOffset});
+                write(outputs[j].data(), outputs[j].size());
+                entry.crc = crc32_combine(entry.crc, crcs[j], blockSize(i));
+            }
+        }
+
+        entry.compressedSize = mOffset - dataOffset;
+        const std::vector<unsigned char> localHeader = zipLocalHeader(entry, 0, 0, zip64);
+        pwriteAll(mFd, localHeader.data(), localHeader.size(), entry.headerOffset, mFname);
+
+        mEntries.push_back(entry);
+    }
+
+    /**
+     * @brief Write a `npy` entry compressed with zstd, as a single frame
+     *
+     * With several threads the frame is produced by the workers of libzstd,
+     * when it is built with them.
+     */
+    void addZstd(const std::string& name, const std::vector<char>& header,
+                 FilteredData source, const int level, const unsigned numThreads)
+    {
+#ifdef CNPY_HAVE_ZSTD
+        if(level!=-1 && (level<1 || level>ZSTD_maxCLevel()))
+            throw std::runtime_error("Invalid zstd level "+std::to_string(level)+" for "+name);
+
+        std::unique_ptr<ZSTD_CCtx, size_t(*)(ZSTD_CCtx*)> context(ZSTD_createCCtx(), ZSTD_freeCCtx);
+        if(!context)
+            throw std::runtime_error("Error initializing the encoder for "+name);
+        ZSTD_CCtx* cctx = context.get();
+        if(ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level==-1 ? ZSTD_CLEVEL_DEFAULT : level)))
+            throw std::runtime_error("Error initializing the encoder for "+name);
+        // Fails harmlessly when libzstd is built without threads
+        const size_t threads = threadCount(numThreads);
+        if(threads>1)
+            ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, threads);
+
+        ZipEntry entry;
+        entry.name = name;
+        entry.flags = 0;
+        entry.method = ZIP_METHOD_ZSTD;
+        zipDosDateTime(entry.dosTime, entry.dosDate);
+        setFilter(entry, source);
+        entry.crc = crc32Update(0, header.data(), header.size());
+        entry.uncompressedSize = header.size() + source.size();
+        entry.compressedSize = 0;
+        entry.headerOffset = mOffset;
+        // The frame header records the size, so the decoder can size its window
+        ZSTD_CCtx_setPledgedSrcSize(cctx, entry.uncompressedSize);
+
+        const bool zip64 = ZSTD_compressBound(entry.uncompressedSize)>=ZIP32_LIMIT ||
+                           entry.uncompressedSize>=ZIP32_LIMIT;
+        mOffset += zipLocalHeader(entry, 0, 0, zip64).size();
+        const uint64_t dataOffset = mOffset;
+
+        std::vector<unsigned char> output(ZSTD_CStreamOutSize());
+        const auto compress = [&](const void* input, const size_t size, const ZSTD_EndDirective mode) {
+            ZSTD_inBuffer in = {input, size, 0};
+            size_t left;
+            do
+            {
+                ZSTD_outBuffer out = {output.data(), output.size(), 0};
+                left = ZSTD_compressStream2(cctx, &out, &in, mode);
+                if(ZSTD_isError(left))
+                    throw std::runtime_error("Error compressing "+name+": "+ZSTD_getErrorName(left));
+                write(output.data(), out.pos);
+            } while(mode==ZSTD_e_end ? left>0 : in.pos<in.size);
+        };
+        compress(header.data(), header.size(), ZSTD_e_continue);
+        for(size_t begin=0; begin==0 || begin<source.size(); begin+=ENCODER_INPUT_SIZE)
+        {
+            const size_t size = std::min(ENCODER_INPUT_SIZE, source.size()-begin);
+            const unsigned char* input = source.get(begin, begin+size);
+            entry.crc = crc32Update(entry.crc, input, size);
+            compress(input, size, begin+size<source.size() ? ZSTD_e_continue : ZSTD_e_end);
+        }
+
+        entry.compressedSize = mOffset - dataOffset;
+        const std::vector<unsigned char> localHeader = zipLocalHeader(entry, 0, 0, zip64);
+        pwriteAll(mFd, localHeader.data(), localHeader.size(), entry.headerOffset, mFname);
+
+        mEntries.push_back(entry);
+#else
+        (void)header;
+        (void)source;
+        (void)level;
+        (void)numThreads;
+        throw std::runtime_error("Can not compress "+name+": cnpy is built without zstd");
+#endif
+    }
+
+    /**
+     * @brief Write a `npy` entry compressed with lz4, as a single frame
+     */
+    void addLz4(const std::string& name, const std::vector<char>& header,
+                FilteredData source, const int level)
+    {
+#ifdef CNPY_HAVE_LZ4
+        if(level!=-1 && (level<1 || level>LZ4F_compressionLevel_max()))
+            throw std::runtime_error("Invalid lz4 level "+std::to_string(level)+" for "+name);
+
+        LZ4F_cctx* cctx;
+        if(LZ4F_isError(LZ4F_createCompressionContext(&cctx, LZ4F_VERSION)))
+            throw std::runtime_error("Error initializing the encoder for "+name);
+        std::unique_ptr<LZ4F_cctx, LZ4F_errorCode_t(*)(LZ4F_cctx*)> context(cctx, LZ4F_freeCompressionContext);
+
+        ZipEntry entry;
+        entry.name = name;
+        entry.flags = 0;
+        entry.method = ZIP_METHOD_LZ4;
+        zipDosDateTime(entry.dosTime, entry.dosDate);
+        setFilter(entry, source);
+        entry.crc = crc32Update(0, header.data(), header.size());
+        entry.uncompressedSize = header.size() + source.size();
+        entry.compressedSize = 0;
+        entry.headerOffset = mOffset;
+
+        // Levels from 3 up select the high compression encoder
+        LZ4F_preferences_t preferences;
+        std::memset(&preferences, 0, sizeof(preferences));
+        preferences.frameInfo.contentSize = entry.uncompressedSize;
+        preferences.compressionLevel = level==-1 ? 0 : level;
+
+        const bool zip64 = LZ4F_compressFrameBound(entry.uncompressedSize, &preferences)>=ZIP32_LIMIT ||
+                           entry.uncompressedSize>=ZIP32_LIMIT;
+        mOffset += zipLocalHeader(entry, 0, 0, zip64).size();
+        const uint64_t dataOffset = mOffset;
+
+        std::vector<unsigned char> output(LZ4F_compressBound(ENCODER_INPUT_SIZE, &preferences));
+        const auto emit = [&](const size_t ret) {
+            if(LZ4F_isError(ret))
+                throw std::runtime_error("Error compressing "+name+": "+LZ4F_getErrorName(ret));
+            write(output.data(), ret);
+        };
+        emit(LZ4F_compressBegin(cctx, output.data(), output.size(), &preferences));
+        emit(LZ4F_compressUpdate(cctx, output.data(), output.size(), header.data(), header.size(), nullptr));
+        for(size_t begin=0; begin<source.size(); begin+=ENCODER_INPUT_SIZE)
+        {
+            const size_t size = std::min(ENCODER_INPUT_SIZE, source.size()-begin);
+            const unsigned char* input = source.get(begin, begin+size);
+            entry.crc = crc32Update(entry.crc, input, size);
+            emit(LZ4F_compressUpdate(cctx, output.data(), output.size(), input, size, nullptr));
+        }
+        emit(LZ4F_compressEnd(cctx, output.data(), output.size(), nullptr));
+
+        entry.compressedSize = mOffset - dataOffset;
+        const std::vector<unsigned char> localHeader = zipLocalHeader(entry, 0, 0, zip64);
+        pwriteAll(mFd, localHeader.data(), localHeader.size(), entry.headerOffset, mFname);
+
+        mEntries.push_back(entry);
+#else
+        (void)header;
+        (void)source;
+        (void)level;
+        throw std::runtime_error("Can not compress "+name+": cnpy is built without lz4");
+#endif
+    }
+
+    /**
+     * @brief Number of entries in the central directory
+     */
+    size_t size() const { return mEntries.size(); }
+
+    /**
+     * @brief End of the entries written so far, where the central directory will go
+     */
+    uint64_t offset() const { return mOffset; }
+
+    /**
+     * @brief Forget the entries written since size() was `count` and offset() was `offset`
+     *
+     * Used to undo a failed write: the central directory written by finish()
+     * is then the one from before it.
+     */
+    void rollback(const size_t count, const uint64_t offset)
+    {
+        mEntries.resize(std::min(count, mEntries.size()));
+        mOffset = offset;
+    }
+
+    /**
+     * @brief Drop an entry from the central directory
+     *
+     * The local header and the data of the entry stay in the file as dead
+     * bytes until compact() is called.
+     * @param count Only the first `count` entries are looked at
+     * @return false if there is no entry with that name
+     */
+    bool remove(const std::string& name, const size_t count=SIZE_MAX)
+    {
+        const std::vector<ZipEntry>::iterator end = mEntries.begin() + std::min(count, mEntries.size());
+        const std::vector<ZipEntry>::iterator it = std::find_if(mEntries.begin(), end,
+                                                                [&name](const ZipEntry& e) { return e.name==name; });
+        if(it==end)
+            return false;
+        mEntries.erase(it);
+        return true;
+    }
+
+    /**
+     * @brief Move the entries over the dead bytes left by removed entries
+     *
+     * Entries are moved towards the beginning of the file in a single pass,
+     * in the order of their offsets. The alignment recorded in the local
+     * header of an entry, if any, is kept.
+     *
+     * @param threshold Fraction of the entries area that must be dead for the
+     *        compaction to take place
+     * @return true if the entries were moved
+     */
+    bool compact(const double threshold)
+    {
+        std::vector<ZipEntry*> order(mEntries.size());
+        std::vector<ZipLocalLayout> layouts(mEntries.size());
+        uint64_t liveBytes = 0;
+        for(size_t i=0; i<mEntries.size(); ++i)
+        {
+            order[i] = &mEntries[i];
+            layouts[i] = zipLocalLayout(mFd, mEntries[i], mFname);
+            liveBytes += layouts[i].dataOffset - mEntries[i].headerOffset + mEntries[i].compressedSize;
+        }
+        const uint64_t deadBytes = mOffset - std::min(liveBytes, mOffset);
+        if(deadBytes==0 || deadBytes<=threshold*mOffset)
+            return false;
+
+        std::sort(order.begin(), order.end(), [](const ZipEntry* a, const ZipEntry* b) { return a->headerOffset<b->headerOffset; });
+
+        std::vector<unsigned char> buffer;
+        uint64_t cursor = 0;
+        for(ZipEntry* entry: order)
+        {
+            const ZipLocalLayout& layout = layouts[entry-mEntries.data()];
+            if(entry->headerOffset==cursor && (entry->flags & 0x0008)==0)
+            {
+                cursor = layout.dataOffset + entry->compressedSize;
+                continue;
+            }
+
+            ZipEntry moved = *entry;
+            moved.flags &= ~0x0008;  // sizes are known, the data descriptor is dropped
+            moved.headerOffset = cursor;
+
+            // The data only moves towards the beginning of the file, so it
+            // can be copied in ascending chunks without overwriting unread bytes
+            std::vector<unsigned char> header = zipLocalHeader(moved, layout.alignment, layout.skew);
+            if(cursor+header.size()>layout.dataOffset)
+                header = zipLocalHeader(moved, 0, 0);
+            if(cursor+header.size()>layout.dataOffset)
+                throw std::runtime_error("Invalid local header for "+entry->name+" in "+mFname);
+            pwriteAll(mFd, header.data(), header.size(), cursor, mFname);
+
+            const uint64_t dataOffset = cursor + header.size();
+            if(dataOffset!=layout.dataOffset)
+            {
+                buffer.resize(std::min<uint64_t>(entry->compressedSize, ZIP_COPY_BUFFER_SIZE));
+                for(uint64_t done=0; done<entry->compressedSize; done+=buffer.size())
+                {
+                    const size_t len = std::min<uint64_t>(buffer.size(), entry->compressedSize-done);
+                    preadAll(mFd, buffer.data(), len, layout.dataOffset+done, mFname);
+                    pwriteAll(mFd, buffer.data(), len, dataOffset+done, mFname);
+                }
+            }
+
+            *entry = moved;
+            cursor = dataOffset + entry->compressedSize;
+        }
+
+        mOffset = cursor;
+        return true;
+    }
+
+    /**
+     * @brief Write the central directory and truncate the file after it
+     */
+    void finish()
+    {
+        const uint64_t cdOffset = mOffset;
+        std::vector<unsigned char> cd;
+        for(const ZipEntry& entry: mEntries)
+        {
+            const std::vector<unsigned char> header = zipCentralHeader(entry);
+            cd.insert(cd.end(), header.begin(), header.end());
+        }
+        const std::vector<unsigned char> eocd = zipEndOfCentralDirectory(mEntries.size(), cdOffset, cd.size());
+        cd.insert(cd.end(), eocd.begin(), eocd.end());
+        write(cd.data(), cd.size());
+
+        if(::ftruncate(mFd, mOffset)!=0)
+            throw std::runtime_error("Error truncating "+mFname);
+    }
+
+private:
+    /**
+     * @brief Resolve Compression::Auto for the data of `source`
+     *
+     * Up to AUTO_SAMPLE_COUNT samples of AUTO_SAMPLE_SIZE bytes, evenly
+     * spread over the data and filtered as they would be, are deflated at
+     * the fastest and at the default level: the array is stored if they
+     * barely shrink, and the default level is only kept if it does
+     * noticeably better than the fastest one.
+     */
+    static cnpy::NpzSaveOptions chooseCompression(FilteredData source, const cnpy::NpzSaveOptions& options)
+    {
+        const size_t dataSize = source.size();
+        const size_t sampleSize = std::min(AUTO_SAMPLE_SIZE, dataSize);
+        const size_t numSamples = dataSize<=AUTO_SAMPLE_SIZE*AUTO_SAMPLE_COUNT ?
+            (dataSize+AUTO_SAMPLE_SIZE-1) / AUTO_SAMPLE_SIZE : AUTO_SAMPLE_COUNT;
+
+        uLong sampled = 0;
+        uLong fastSize = 0;
+        uLong defaultSize = 0;
+        std::vector<unsigned char> output(compressBound(sampleSize));
+        for(size_t i=0; i<numSamples; ++i)
+        {
+            // The samples tile small arrays and are spread over large ones
+            const size_t begin = numSamples<AUTO_SAMPLE_COUNT ? i*AUTO_SAMPLE_SIZE :
+                                 (dataSize-sampleSize) / (numSamples-1) * i;
+            const size_t size = std::min(sampleSize, dataSize-begin);
+            const unsigned char* sample = source.get(begin, begin+size);
+            uLongf fast = output.size();
+            uLongf normal = output.size();
+            if(compress2(output.data(), &fast, sample, size, Z_BEST_SPEED)!=Z_OK ||
+               compress2(output.data(), &normal, sample, size, Z_DEFAULT_COMPRESSION)!=Z_OK)
+                throw std::runtime_error("Error compressing a sample of the data");
+            sampled += size;
+            fastSize += fast;
+            defaultSize += normal;
+        }
+
+        cnpy::NpzSaveOptions chosen = options;
+        if(sampled==0 || fastSize>AUTO_STORE_RATIO*sampled)
+        {
+            chosen.compression = cnpy::Compression::None;
+            return chosen;
+        }
+
+        chosen.compression = cnpy::Compression::Deflate;
+        if(options.level==-1)
+            chosen.level = defaultSize<AUTO_LEVEL_GAIN*fastSize ? Z_DEFAULT_COMPRESSION : Z_BEST_SPEED;
+        return chosen;
+    }
+
+    /**
+     * @brief Record the filter of `source` in `entry`
+     */
+    static void setFilter(ZipEntry& entry, const FilteredData& source)
+    {
+        switch(source.filter())
+        {
+        case cnpy::Filter::Shuffle:
+            entry.filter = 1;
+            break;
+        case cnpy::Filter::BitShuffle:
+            entry.filter = 2;
+            break;
+        default:
+            entry.filter = 0;
+        }
+        entry.filterElemSize = entry.filter!=0 ? source.elemSize() : 0;
+    }
+
+    void write(const void* data, const size_t len)
+    {
+        pwriteAll(mFd, data, len, mOffset, mFname);
+        mOffset += len;
+    }
+
+    int mFd;
+    std::string mFname;
+    uint64_t mOffset;
+    std::vector<ZipEntry> mEntries;
+};
+
+
+/**
+ * @brief Check the options of an array before anything is written
+ */
+static void checkSaveOptions(const cnpy::NpzSaveOptions& options, const std::string& name)
+{
+    switch(options.compression)
+    {
+    case cnpy::Compression::None:
+        break;
+    case cnpy::Compression::Deflate:
+    case cnpy::Compression::Auto:
+        if(options.level!=Z_DEFAULT_COMPRESSION && (options.level<Z_BEST_SPEED || options.level>Z_BEST_COMPRESSION))
+            throw std::runtime_error("Invalid deflate level "+std::to_string(options.level)+" for "+name);
+        break;
+    case cnpy::Compression::Zstd:
+#ifdef CNPY_HAVE_ZSTD
+        if(options.level!=-1 && (options.level<1 || options.level>ZSTD_maxCLevel()))
+            throw std::runtime_error("Invalid zstd level "+std::to_string(options.level)+" for "+name);
+        if(options.seekRows>0)
+            throw std::runtime_error("Restart points are only supported for deflated arrays, not for "+name);
+        break;
+#else
+        throw std::runtime_error("Can not compress "+name+": cnpy is built without zstd");
+#endif
+    case cnpy::Compression::Lz4:
+#ifdef CNPY_HAVE_LZ4
+        if(options.level!=-1 && (options.level<1 || options.level>LZ4F_compressionLevel_max()))
+            throw std::runtime_error("Invalid lz4 level "+std::to_string(options.level)+" for "+name);
+        if(options.seekRows>0)
+            throw std::runtime_error("Restart points are only supported for deflated arrays, not for "+name);
+        break;
+#else
+        throw std::runtime_error("Can not compress "+name+": cnpy is built without lz4");
+#endif
+    default:
+        throw std::runtime_error("Unsupported compression for "+name);
+    }
+
+    if(options.filter!=cnpy::Filter::None && options.filter!=cnpy::Filter::Shuffle &&
+       options.filter!=cnpy::Filter::BitShuffle)
+        throw std::runtime_error("Unsupported filter for "+name);
+    if(options.numThreads>MAX_ENCODER_THREADS)
+        throw std::runtime_error("Too many threads for "+name+": at most "+std::to_string(MAX_ENCODER_THREADS));
+    if(options.alignment>ZIP_MAX_ALIGNMENT)
+        throw std::runtime_error("The alignment of npz entries can not exceed "+std::to_string(ZIP_MAX_ALIGNMENT)+" bytes");
+    if(options.mantissaBits<-1)
+        throw std::runtime_error("Invalid number of mantissa bits "+std::to_string(options.mantissaBits)+" for "+name);
+}
+
+cnpy::NpzWriter::NpzWriter(const std::string& zipname, const char mode, const NpzSaveOptions& options) :
+    mZipname(zipname),
+    mFd(-1),
+    mOptions(options)
+{
+    if(mode!='w' && mode!='a')
+        throw std::runtime_error("Invalid mode for npz file "+zipname+": use 'w' or 'a'");
+
+    if(mode=='a')
+    {
+        mFd = ::open(zipname.c_str(), O_RDWR);
+        if(mFd<0 && errno!=ENOENT)
+            throw std::runtime_error("Error opening npz file "+zipname);
+    }
+
+    if(mFd>=0)
+    {
+        // Append in place: the new entries start where the central directory was
+        try
+        {
+            mZip.reset(new ZipWriter(mFd, zipname, readZipDirectory(mFd, zipname)));
+        }
+        catch(...)
+        {
+            ::close(mFd);
+            throw;
+        }
+        return;
+    }
+
+    mFd = ::open(zipname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(mFd<0)
+        throw std::runtime_error("Error opening npz file "+zipname);
+    mZip.reset(new ZipWriter(mFd, zipname));
+}
+
+cnpy::NpzWriter::~NpzWriter()
+{
+    try
+    {
+        close();
+    }
+    catch(std::exception&)
+    {
+        // Destructors must not throw: call close() to handle errors
+    }
+}
+
+void cnpy::NpzWriter::add(const std::string& name,
+                          const unsigned char* data, const Type dtype,
+                          const size_t elemSize, const std::vector<size_t>& shape,
+                          const NpzSaveOptions& options)
+{
+    addArray(name, data, dtype, elemSize, shape, false, options);
+}
+
+void cnpy::NpzWriter::add(const std::string& name, const NpArray& array)
+{
+    std::vector<size_t> shape(array.nDims());
+    for(size_t i=0; i<shape.size(); ++i)
+        shape[i] = array.shape(i);
+    addArray(name, array.data(), array.dtype(), array.elemSize(), shape, array.isFortranOrder(), mOptions);
+}
+
+void cnpy::NpzWriter::add(const NpArrayDict& arrays)
+{
+    for(const NpArrayDict::value_type& item: arrays)
+        add(item.first, item.second);
+}
+
+bool cnpy::NpzWriter::remove(const std::string& name)
+{
+    if(mFd<0)
+        throw std::runtime_error("Attempting to remove "+name+" from the closed npz file "+mZipname);
+    return mZip->remove(name + ".npy");
+}
+
+bool cnpy::NpzWriter::compact(const double threshold)
+{
+    if(mFd<0)
+        throw std::runtime_error("Attempting to compact the closed npz file "+mZipname);
+    return mZip->compact(threshold);
+}
+
+void cnpy::NpzWriter::close()
+{
+    if(mFd<0)
+        return;
+
+    const int fd = mFd;
+    mFd = -1;
+    try
+    {
+        mZip->finish();
+    }
+    catch(...)
+    {
+        ::close(fd);
+        throw;
+    }
+    if(::close(fd)!=0)
+        throw std::runtime_error("Error closing npz file "+mZipname);
+}
+
+void cnpy::NpzWriter::addArray(const std::string& name,
+                               const unsigned char* data, const Type dtype,
+                               const size_t elemSize, const std::vector<size_t>& shape,
+                               const bool fortranOrder, const NpzSaveOptions& options)
+{
+    if(mFd<0)
+        throw std::runtime_error("Attempting to add "+name+" to the closed npz file "+mZipname);
+    checkSaveOptions(options, name);
+
+    const std::string fname = name + ".npy";
+    const std::vector<char> header = create_npy_header(dtype, elemSize, shape, fortranOrder);
+    const size_t dataSize = std::accumulate(shape.cbegin(), shape.cend(), elemSize, std::multiplies<size_t>());
+
+    // Every full flush of the encoder costs compression: the interval is
+    // widened so that the entry gets at most ZIP_MAX_SEEK_POINTS of them
+    size_t restartInterval = 0;
+    if(options.seekRows>0 && !shape.empty() && shape[0]>0)
+    {
+        const size_t minRows = (shape[0]+ZIP_MAX_SEEK_POINTS-1) / ZIP_MAX_SEEK_POINTS;
+        restartInterval = std::min(std::max(options.seekRows, minRows), shape[0]) * (dataSize/shape[0]);
+    }
+
+    const size_t floatSize = floatComponentSize(dtype, elemSize);
+    RoundingError roundingError;
+
+    // The new entry is written first: if that fails, the archive keeps
+    // what it had before, including an array with the same name
+    const size_t count = mZip->size();
+    const uint64_t offset = mZip->offset();
+    try
+    {
+        mZip->add(fname, header, data, dataSize, elemSize, floatSize, options, restartInterval,
+                  options.maxError!=nullptr ? &roundingError : nullptr);
+    }
+    catch(...)
+    {
+        mZip->rollback(count, offset);
+        throw;
+    }
+
+    // An existing array with the same name is replaced: only its entry in the
+    // central directory goes away, its bytes are reclaimed by compact()
+    mZip->remove(fname, count);
+
+    // Only reported once the array is saved
+    if(options.maxError!=nullptr)
+        *options.maxError = std::max(*options.maxError, roundingError.max());
+}
+
+
+void cnpy::npz_save_data(const std::string& zipname, const std::string& name,
+                         const unsigned char* data, const cnpy::Type dtype,
+                         const size_t elemSize, const std::vector<size_t>& shape,
+                         const char mode, const NpzSaveOptions& options)
+{
+    NpzWriter zip(zipname, mode, options);
+    zip.add(name, data, dtype, elemSize, shape, options);
+    zip.close();
+}
+
+bool cnpy::npz_remove(const std::string& zipname, const std::string& name)
+{
+    {
+        // Look the entry up read-only first: a missing entry leaves the file untouched
+        FileDescriptor fd(::open(zipname.c_str(), O_RDONLY));
+        if(fd.handle()<0)
+            throw std::runtime_error("Error opening npz file "+zipname);
+        const std::vector<ZipEntry> entries = readZipDirectory(fd.handle(), zipname).entries;
+        const std::string entryName = name + ".npy";
+        if(std::none_of(entries.begin(), entries.end(), [&entryName](const ZipEntry& e) { return e.name==entryName; }))
+            return false;
+    }
+
+    NpzWriter zip(zipname, 'a');
+    const bool removed = zip.remove(name);
+    zip.close();
+    return removed;
+}
+
+
+
+cnpy::NpArray cnpy::npy_load(const std::string& fname)
+{
+    Handler<std::FILE> fp = std::fopen(fname.c_str(), "r");
     if(fp.handle()==NULL)
         throw std::runtime_error("Error opening npy file "+fname);
 
-    NpArray arr = load_the_npy_file(fp);
+    NpArray arr = load_the_npy_file(fp);
+
+    return arr;
+}
+
+cnpy::NpArray cnpy::npy_mmap(const std::string& fname, const MapMode mode)
+{
+    std::shared_ptr<MemoryMap> mapping = std::make_shared<MemoryMap>(fname, mode);
+
+    std::vector<size_t> shape;
+    size_t word_size;
+    bool fortran_order;
+    char elType;
+    const size_t dataOffset = parseNpyBuffer(mapping->data(), mapping->size(),
+                                             word_size, shape, fortran_order, elType);
+
+    NpArray arr(shape, word_size, descr2Type(elType, word_size), fortran_order,
+                mapping, mapping->data()+dataOffset);
+    if(mapping->size()-dataOffset<arr.size())
+        throw std::runtime_error("npy file "+fname+" is truncated: expected "+std::to_string(arr.size())+" bytes of data");
+
+    return arr;
+}
+
+
+/**
+ * @brief Call `fn(offset, size)` for each contiguous byte run of a hyperslab, in file order
+ * @param shape Shape of the array in storage order, slowest varying axis first
+ * @param slices Slices in storage order, clamped to `shape` and with at least one element
+ * @param elemSize Size in bytes of each element
+ *
+ * Offsets are relative to the beginning of the array data. Runs that touch
+ * each other are merged.
+ */
+template<typename _Fn>
+static void forEachHyperslabRun(const std::vector<size_t>& shape, const std::vector<cnpy::Slice>& slices,
+                                const size_t elemSize, _Fn fn)
+{
+    const size_t ndims = shape.size();
+
+    // Bytes spanned by one step along each axis
+    std::vector<uint64_t> stride(ndims);
+    uint64_t total = elemSize;
+    for(size_t i=ndims; i-->0; )
+    {
+        stride[i] = total;
+        total *= shape[i];
+    }
+
+    // The innermost axes read whole are part of every run
+    size_t k = ndims;
+    while(k>0 && slices[k-1].start==0 && slices[k-1].stop==shape[k-1] && slices[k-1].step==1)
+        --k;
+    if(k==0)
+    {
+        fn(0, total);
+        return;
+    }
+
+    // A unit step along the innermost partial axis extends the runs too
+    uint64_t runSize = stride[k-1];
+    uint64_t base = 0;
+    size_t numAxes = k;
+    if(slices[k-1].step==1)
+    {
+        runSize *= slices[k-1].stop - slices[k-1].start;
+        base = slices[k-1].start * stride[k-1];
+        numAxes = k - 1;
+    }
+
+    std::vector<size_t> counts(numAxes);
+    for(size_t i=0; i<numAxes; ++i)
+        counts[i] = (slices[i].stop - slices[i].start + slices[i].step - 1) / slices[i].step;
+
+    uint64_t pendingOffset = 0;
+    uint64_t pendingSize = 0;
+    std::vector<size_t> index(numAxes, 0);
+    while(true)
+    {
+        uint64_t offset = base;
+        for(size_t i=0; i<numAxes; ++i)
+            offset += (slices[i].start + index[i]*slices[i].step) * stride[i];
+
+        if(pendingSize>0 && pendingOffset+pendingSize==offset)
+            pendingSize += runSize;
+        else
+        {
+            if(pendingSize>0)
+                fn(pendingOffset, pendingSize);
+            pendingOffset = offset;
+            pendingSize = runSize;
+        }
+
+        // Odometer increment, the last axis varies fastest
+        size_t axis = numAxes;
+        while(axis>0 && ++index[axis-1]==counts[axis-1])
+            index[--axis] = 0;
+        if(axis==0)
+            break;
+    }
+    fn(pendingOffset, pendingSize);
+}
+
+
+/**
+ * @brief Clamp `slices` to `shape`; missing slices select a whole axis
+ * @param outShape Receives the shape of the selection
+ * @return false if the selection is empty
+ */
+static bool clampSlices(const std::vector<size_t>& shape, const std::vector<cnpy::Slice>& slices,
+                        std::vector<cnpy::Slice>& clamped, std::vector<size_t>& outShape)
+{
+    if(slices.size()>shape.size())
+        throw std::runtime_error("Too many slices for an array with "+std::to_string(shape.size())+" dimensions");
+
+    clamped.resize(shape.size());
+    outShape.resize(shape.size());
+    bool isEmpty = false;
+    for(size_t i=0; i<shape.size(); ++i)
+    {
+        cnpy::Slice s = i<slices.size() ? slices[i] : cnpy::Slice();
+        if(s.step==0)
+            throw std::runtime_error("Slice step must be greater than 0");
+        s.stop = std::min(s.stop, shape[i]);
+        s.start = std::min(s.start, s.stop);
+        clamped[i] = s;
+        outShape[i] = (s.stop - s.start + s.step - 1) / s.step;
+        isEmpty = isEmpty || outShape[i]==0;
+    }
+
+    return !isEmpty;
+}
+
+/**
+ * @brief Read a hyperslab of an array
+ * @param read Function reading `size` bytes at `offset` from the beginning
+ *        of the array data into a buffer; offsets are increasing
+ */
+template<typename _ReadFn>
+static cnpy::NpArray readSlice(std::vector<size_t> shape, const size_t word_size, const cnpy::Type dtype,
+                               const bool fortran_order, const std::vector<cnpy::Slice>& slices, _ReadFn read)
+{
+    std::vector<cnpy::Slice> clamped;
+    std::vector<size_t> outShape;
+    const bool hasData = clampSlices(shape, slices, clamped, outShape);
+
+    cnpy::NpArray arr(outShape, word_size, dtype, fortran_order);
+    if(!hasData)
+        return arr;
+
+    // Runs are computed in storage order, that is reversed for fortran arrays
+    if(fortran_order)
+    {
+        std::reverse(shape.begin(), shape.end());
+        std::reverse(clamped.begin(), clamped.end());
+    }
+
+    unsigned char* dst = arr.data();
+    forEachHyperslabRun(shape, clamped, word_size, [&](uint64_t offset, uint64_t size) {
+        read(dst, offset, size);
+        dst += size;
+    });
+
+    return arr;
+}
+
+/**
+ * @brief Reader of many ranges of a file, in increasing offset order
+ *
+ * Ranges separated by less than READ_COALESCE_GAP bytes are read with a
+ * single vectored read of the whole span: the gaps land in a scratch
+ * buffer and the ranges go straight to their destination. Ranges further
+ * apart are read with separate calls.
+ */
+class CoalescingReader
+{
+public:
+    CoalescingReader(const int fd, const std::string& fname):
+        mFd(fd),
+        mFname(fname),
+        mStart(0),
+        mEnd(0)
+    {}
+
+    /**
+     * @brief Queue the read of `size` bytes at `offset` into `dst`
+     */
+    void add(unsigned char* dst, const uint64_t offset, const uint64_t size)
+    {
+        if(!mIov.empty() && (offset-mEnd>READ_COALESCE_GAP || mIov.size()+2>IOV_MAX))
+            flush();
+
+        if(mIov.empty())
+            mStart = offset;
+        else if(offset>mEnd)
+        {
+            // Gaps never exceed READ_COALESCE_GAP: the scratch buffer is allocated once
+            if(mScratch.empty())
+                mScratch.resize(READ_COALESCE_GAP);
+            pushIov(mScratch.data(), offset-mEnd);
+        }
+        pushIov(dst, size);
+        mEnd = offset + size;
+    }
+
+    /**
+     * @brief Read the queued ranges
+     */
+    void flush()
+    {
+        struct iovec* iov = mIov.data();
+        int iovcnt = mIov.size();
+        uint64_t offset = mStart;
+        while(iovcnt>0)
+        {
+            ssize_t nread = ::preadv(mFd, iov, iovcnt, offset);
+            if(nread<0 && errno==EINTR)
+                continue;
+            if(nread<=0)
+                throw std::runtime_error("Error reading "+std::to_string(mEnd-offset)+" bytes at offset "+std::to_string(offset)+" of "+mFname);
+            offset += nread;
+
+            // Skip the buffers filled completely and resume in the middle of a partial one
+            while(iovcnt>0 && size_t(nread)>=iov->iov_len)
+            {
+                nread -= iov->iov_len;
+                ++iov;
+                --iovcnt;
+            }
+            if(iovcnt>0)
+            {
+                iov->iov_base = reinterpret_cast<unsigned char*>(iov->iov_base) + nread;
+                iov->iov_len -= nread;
+            }
+        }
+        mIov.clear();
+    }
+
+private:
+    void pushIov(void* base, const size_t len)
+    {
+        struct iovec iov;
+        iov.iov_base = base;
+        iov.iov_len = len;
+        mIov.push_back(iov);
+    }
+
+    int mFd;
+    const std::string& mFname;
+    uint64_t mStart;
+    uint64_t mEnd;
+    std::vector<struct iovec> mIov;
+    std::vector<unsigned char> mScratch;
+};
+
+
+/**
+ * @brief Read a hyperslab of the array stored in a file at `dataOffset` with positional reads
+ */
+static cnpy::NpArray preadSlice(const int fd, const std::string& fname, const uint64_t dataOffset,
+                                const std::vector<size_t>& shape, const size_t word_size, const cnpy::Type dtype,
+                                const bool fortran_order, const std::vector<cnpy::Slice>& slices)
+{
+    CoalescingReader reader(fd, fname);
+    cnpy::NpArray arr = readSlice(shape, word_size, dtype, fortran_order, slices,
+                            [&reader, dataOffset](unsigned char* dst, uint64_t offset, uint64_t size) {
+        reader.add(dst, dataOffset+offset, size);
+    });
+    reader.flush();
+
+    return arr;
+}
+
+
+/**
+ * @brief Slice of `count` rows from `first`, saturating instead of overflowing
+ */
+static cnpy::Slice rowSlice(const size_t first, const size_t count)
+{
+    const size_t stop = count>std::numeric_limits<size_t>::max()-first ? std::numeric_limits<size_t>::max() : first+count;
+    return cnpy::Slice(first, stop);
+}
+
+
+cnpy::NpArray cnpy::npy_load_slice(const std::string& fname, const std::vector<Slice>& slices)
+{
+    FileDescriptor fd(::open(fname.c_str(), O_RDONLY));
+    if(fd.handle()<0)
+        throw std::runtime_error("Error opening npy file "+fname);
+
+    std::vector<size_t> shape;
+    size_t word_size;
+    bool fortran_order;
+    char elType;
+    const uint64_t dataOffset = readNpyHeader(fd.handle(), fname, word_size, shape, fortran_order, elType);
+
+    return preadSlice(fd.handle(), fname, dataOffset, shape, word_size, descr2Type(elType, word_size),
+                      fortran_order, slices);
+}
+
+
+cnpy::NpArray cnpy::npy_load_rows(const std::string& fname, const size_t first, const size_t count)
+{
+    return npy_load_slice(fname, std::vector<Slice>(1, rowSlice(first, count)));
+}
+
+
+cnpy::NpArray cnpy::npy_load_strided(const std::string& fname, const size_t step, const size_t first)
+{
+    return npy_load_slice(fname, std::vector<Slice>(1, Slice(first, std::numeric_limits<size_t>::max(), step)));
+}
+
+
+cnpy::NpArray cnpy::npy_load_columns(const std::string& fname, const std::vector<size_t>& columns)
+{
+    FileDescriptor fd(::open(fname.c_str(), O_RDONLY));
+    if(fd.handle()<0)
+        throw std::runtime_error("Error opening npy file "+fname);
+
+    std::vector<size_t> shape;
+    size_t word_size;
+    bool fortran_order;
+    char elType;
+    const uint64_t dataOffset = readNpyHeader(fd.handle(), fname, word_size, shape, fortran_order, elType);
+
+    if(shape.size()!=2)
+        throw std::runtime_error("Column projection needs a 2-dimensional array, "+fname+" has "+std::to_string(shape.size()));
+    const size_t rows = shape[0];
+    const size_t cols = shape[1];
+    for(size_t c: columns)
+    {
+        if(c>=cols)
+            throw std::runtime_error("Column "+std::to_string(c)+" out of range for "+fname);
+    }
+
+    NpArray arr(std::vector<size_t>{rows, columns.size()}, word_size, descr2Type(elType, word_size), fortran_order);
+    if(rows==0 || columns.empty())
+        return arr;
+
+    unsigned char* dst = arr.data();
+    if(fortran_order)
+    {
+        // Each column is contiguous: one read per run of consecutive columns
+        const uint64_t colBytes = uint64_t(rows) * word_size;
+        size_t runStart = 0;
+        for(size_t i=1; i<=columns.size(); ++i)
+        {
+            if(i<columns.size() && columns[i]==columns[i-1]+1)
+                continue;
+            const uint64_t size = (i-runStart) * colBytes;
+            preadAll(fd.handle(), dst, size, dataOffset+columns[runStart]*colBytes, fname);
+            dst += size;
+            runStart = i;
+        }
+        return arr;
+    }
+
+    // C order: gather the columns from the span of each row that contains them
+    const size_t minCol = *std::min_element(columns.begin(), columns.end());
+    const size_t maxCol = *std::max_element(columns.begin(), columns.end());
+    const uint64_t rowBytes = uint64_t(cols) * word_size;
+    const uint64_t spanBytes = uint64_t(maxCol-minCol+1) * word_size;
+
+    // Consecutive spans are read together unless the gap between them costs
+    // more than a seek, then each span is read on its own
+    const bool sequential = rowBytes-spanBytes <= READ_COALESCE_GAP;
+    const uint64_t stride = sequential ? rowBytes : spanBytes;
+    const size_t blockRows = std::max<uint64_t>(1, READ_CHUNK_SIZE / stride);
+
+    std::vector<unsigned char> buffer(std::min<uint64_t>(blockRows, rows) * stride);
+    for(size_t r=0; r<rows; r+=blockRows)
+    {
+        const size_t n = std::min(blockRows, rows-r);
+        const uint64_t offset = dataOffset + r*rowBytes + minCol*word_size;
+        if(sequential)
+            preadAll(fd.handle(), buffer.data(), (n-1)*rowBytes+spanBytes, offset, fname);
+        else
+        {
+            for(size_t i=0; i<n; ++i)
+                preadAll(fd.handle(), &buffer[i*stride], spanBytes, offset+i*rowBytes, fname);
+        }
+
+        for(size_t i=0; i<n; ++i)
+        {
+            const unsigned char* row = &buffer[i*stride];
+            for(size_t c: columns)
+            {
+                std::memcpy(dst, row+(c-minCol)*word_size, word_size);
+                dst += word_size;
+            }
+        }
+    }
+
+    return arr;
+}
+
+
+cnpy::NpyRowReader::NpyRowReader(const std::string& fname, const size_t blockRows) :
+    mFname(fname),
+    mFd(-1),
+    mBlockRows(blockRows),
+    mNextRow(0)
+{
+    if(blockRows==0)
+        throw std::runtime_error("The number of rows of each block must be greater than 0");
+
+    mFd = ::open(fname.c_str(), O_RDONLY);
+    if(mFd<0)
+        throw std::runtime_error("Error opening npy file "+fname);
+
+    try
+    {
+        char elType;
+        mDataOffset = readNpyHeader(mFd, fname, mElemSize, mShape, mIsFortranOrder, elType);
+        mDtype = descr2Type(elType, mElemSize);
+        if(mShape.empty())
+            throw std::runtime_error("Can not read rows of the 0-dimensional array in "+fname);
+    }
+    catch(...)
+    {
+        ::close(mFd);
+        throw;
+    }
+}
+
+cnpy::NpyRowReader::~NpyRowReader()
+{
+    ::close(mFd);
+}
+
+bool cnpy::NpyRowReader::next(NpArray& block)
+{
+    if(mNextRow>=mShape[0])
+        return false;
+
+    const Slice rows = rowSlice(mNextRow, mBlockRows);
+    mNextRow = std::min(mShape[0], rows.stop);
+    block = preadSlice(mFd, mFname, mDataOffset, mShape, mElemSize, mDtype, mIsFortranOrder,
+                       std::vector<Slice>(1, rows));
+    return true;
+}
+
+
+/**
+ * @brief Whether entries compressed with `method` can be decoded
+ */
+static bool zipMethodSupported(const uint16_t method)
+{
+    switch(method)
+    {
+    case ZIP_METHOD_STORE:
+    case ZIP_METHOD_DEFLATE:
+#ifdef CNPY_HAVE_ZSTD
+    case ZIP_METHOD_ZSTD:
+#endif
+#ifdef CNPY_HAVE_LZ4
+    case ZIP_METHOD_LZ4:
+#endif
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Raw inflate stream and buffer of compressed input, reused across entries
+ */
+struct InflateState
+{
+    InflateState() : initialized(false), busy(false) {}
+    ~InflateState()
+    {
+        if(initialized)
+            inflateEnd(&stream);
+    }
+
+    z_stream stream;
+    std::vector<unsigned char> input;
+    bool initialized;
+    bool busy;      //!< Whether a reader is using the state
+};
+
+/**
+ * @brief The inflate state of the calling thread
+ *
+ * Threads decoding entries of the same archive never share a decoder, and a
+ * thread decoding many entries initializes its decoder only once.
+ */
+static InflateState& threadInflateState()
+{
+    thread_local InflateState state;
+    return state;
+}
+
+
+/**
+ * @brief Sequential reader of the uncompressed bytes of a zip entry
+ *
+ * The compressed data is read with pread, so several readers can share
+ * the same file descriptor. The CRC of the entry is checked once all its
+ * bytes have been read, unless disabled.
+ */
+class ZipEntryReader
+{
+public:
+    /**
+     * @param dataOffset Offset of the entry data, right after its local header
+     * @param checkCrc Whether to check the CRC of the entry
+     * @param inputSize Size of the reads of compressed data
+     */
+    ZipEntryReader(const int fd, const ZipEntry& entry, const std::string& fname,
+                   const uint64_t dataOffset, const bool checkCrc=true,
+                   const uint64_t inputSize=INFLATE_INPUT_SIZE) :
+        mFd(fd),
+        mEntry(entry),
+        mFname(fname),
+        mDataOffset(dataOffset),
+        mOffset(dataOffset),
+        mInputLeft(entry.compressedSize),
+        mProduced(0),
+        mCheckCrc(checkCrc),
+        mCrc(0),
+        mState(nullptr)
+    {
+        if(entry.flags & 0x1)
+            throw std::runtime_error("Encrypted entry "+entry.name+" in "+fname+" is not supported");
+        if(!zipMethodSupported(entry.method))
+            throw std::runtime_error("Unsupported compression method for "+entry.name+" in "+fname);
+
+        if(entry.method==ZIP_METHOD_DEFLATE)
+        {
+            // The decoder of the thread is reused, unless another reader holds it
+            InflateState& shared = threadInflateState();
+            if(shared.busy)
+            {
+                mOwnState.reset(new InflateState());
+                mState = mOwnState.get();
+            }
+            else
+                mState = &shared;
+
+            z_stream& stream = mState->stream;
+            if(!mState->initialized)
+            {
+                stream.zalloc = Z_NULL;
+                stream.zfree = Z_NULL;
+                stream.opaque = Z_NULL;
+                stream.next_in = Z_NULL;
+                stream.avail_in = 0;
+                // Negative window bits: raw deflate data, without zlib header
+                if(inflateInit2(&stream, -MAX_WBITS)!=Z_OK)
+                    throw std::runtime_error("Error initializing the decoder for "+entry.name+" in "+fname);
+                mState->initialized = true;
+            }
+            else if(inflateReset(&stream)!=Z_OK)
+                throw std::runtime_error("Error initializing the decoder for "+entry.name+" in "+fname);
+
+            stream.next_in = Z_NULL;
+            stream.avail_in = 0;
+            mState->input.resize(std::min(entry.compressedSize, inputSize));
+            mState->busy = true;
+        }
+        else if(entry.method!=ZIP_METHOD_STORE)
+        {
+#ifdef CNPY_HAVE_ZSTD
+            if(entry.method==ZIP_METHOD_ZSTD)
+                mZstd.reset(ZSTD_createDCtx());
+            if(entry.method==ZIP_METHOD_ZSTD && !mZstd)
+                throw std::runtime_error("Error initializing the decoder for "+entry.name+" in "+fname);
+#endif
+#ifdef CNPY_HAVE_LZ4
+            LZ4F_dctx* dctx;
+            if(entry.method==ZIP_METHOD_LZ4)
+            {
+                if(LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)))
+                    throw std::runtime_error("Error initializing the decoder for "+entry.name+" in "+fname);
+                mLz4.reset(dctx);
+            }
+#endif
+            mInput.resize(std::min(entry.compressedSize, inputSize));
+        }
+    }
+
+    ~ZipEntryReader()
+    {
+        if(mState)
+            mState->busy = false;
+    }
+
+    ZipEntryReader(const ZipEntryReader&) = delete;
+    ZipEntryReader& operator=(const ZipEntryReader&) = delete;
+
+    /**
+     * @brief Read up to `len` bytes, less only at the end of the entry
+     */
+    size_t read(void* buffer, const size_t len)
+    {
+        const size_t nread = mEntry.method==ZIP_METHOD_STORE ? readStored(buffer, len) :
+                             mEntry.method==ZIP_METHOD_DEFLATE ? inflate(buffer, len) : decode(buffer, len);
+        mProduced += nread;
+        if(!mCheckCrc)
+            return nread;
+        mCrc = crc32Update(mCrc, buffer, nread);
+        if(mProduced==mEntry.uncompressedSize && mCrc!=mEntry.crc)
+            throw std::runtime_error("CRC mismatch for "+mEntry.name+" in "+mFname);
+        return nread;
+    }
+
+    /**
+     * @brief Continue decoding from a restart point of a deflated entry
+     *
+     * The CRC can not be checked after a jump.
+     */
+    void seek(const SeekPoint& point)
+    {
+        if(mEntry.method!=ZIP_METHOD_DEFLATE || point.compressedOffset>mEntry.compressedSize)
+            throw std::runtime_error("Invalid restart point for "+mEntry.name+" in "+mFname);
+        if(inflateReset(&mState->stream)!=Z_OK)
+            throw std::runtime_error("Error initializing the decoder for "+mEntry.name+" in "+mFname);
+        mState->stream.avail_in = 0;
+        mOffset = mDataOffset + point.compressedOffset;
+        mInputLeft = mEntry.compressedSize - point.compressedOffset;
+        mProduced = point.uncompressedOffset;
+        mCheckCrc = false;
+    }
+
+private:
+    size_t readStored(void* buffer, const size_t len)
+    {
+        const size_t nread = std::min<uint64_t>(len, mInputLeft);
+        preadAll(mFd, buffer, nread, mOffset, mFname);
+        mOffset += nread;
+        mInputLeft -= nread;
+        return nread;
+    }
+
+    size_t inflate(void* buffer, const size_t len)
+    {
+        mState->stream.next_out = static_cast<Bytef*>(buffer);
+        size_t left = len;
+        while(left>0)
+        {
+            if(mState->stream.avail_in==0 && mInputLeft>0)
+            {
+                const size_t chunk = std::min<uint64_t>(mState->input.size(), mInputLeft);
+                preadAll(mFd, mState->input.data(), chunk, mOffset, mFname);
+                mOffset += chunk;
+                mInputLeft -= chunk;
+                mState->stream.next_in = mState->input.data();
+                mState->stream.avail_in = chunk;
+            }
+
+            // avail_out is 32 bits wide
+            const uInt out = std::min<size_t>(left, std::numeric_limits<uInt>::max());
+            mState->stream.avail_out = out;
+            const int ret = ::inflate(&mState->stream, Z_NO_FLUSH);
+            left -= out - mState->stream.avail_out;
+            if(ret==Z_STREAM_END)
+                break;
+            if(ret==Z_BUF_ERROR && mState->stream.avail_in==0 && mInputLeft==0)
+                throw std::runtime_error("Truncated data for "+mEntry.name+" in "+mFname);
+            if(ret!=Z_OK && ret!=Z_BUF_ERROR)
+                throw std::runtime_error("Error decoding "+mEntry.name+" in "+mFname);
+        }
+        return len - left;
+    }
+
+    /**
+     * @brief Decode zstd or lz4 data
+     */
+    size_t decode(void* buffer, const size_t len)
+    {
+#if !defined(CNPY_HAVE_ZSTD) && !defined(CNPY_HAVE_LZ4)
+        // Unreachable: the constructor rejects the methods decoded here
+        (void)buffer;
+#endif
+        size_t produced = 0;
+        while(produced<len)
+        {
+            if(mInputPos==mInputEnd && mInputLeft>0)
+            {
+                const size_t chunk = std::min<uint64_t>(mInput.size(), mInputLeft);
+                preadAll(mFd, mInput.data(), chunk, mOffset, mFname);
+                mOffset += chunk;
+                mInputLeft -= chunk;
+                mInputPos = 0;
+                mInputEnd = chunk;
+            }
+
+            const size_t consumed = mInputPos;
+            size_t size = len - produced;
+            bool end = false;
+#ifdef CNPY_HAVE_ZSTD
+            if(mEntry.method==ZIP_METHOD_ZSTD)
+            {
+                ZSTD_inBuffer in = {mInput.data(), mInputEnd, mInputPos};
+                ZSTD_outBuffer out = {static_cast<unsigned char*>(buffer)+produced, size, 0};
+                const size_t ret = ZSTD_decompressStream(mZstd.get(), &out, &in);
+                if(ZSTD_isError(ret))
+                    throw std::runtime_error("Error decoding "+mEntry.name+" in "+mFname);
+                mInputPos = in.pos;
+                size = out.pos;
+                end = ret==0;
+            }
+#endif
+#ifdef CNPY_HAVE_LZ4
+            if(mEntry.method==ZIP_METHOD_LZ4)
+            {
+                size_t inSize = mInputEnd - mInputPos;
+                const size_t ret = LZ4F_decompress(mLz4.get(), static_cast<unsigned char*>(buffer)+produced, &size,
+                                                   mInput.data()+mInputPos, &inSize, nullptr);
+                if(LZ4F_isError(ret))
+                    throw std::runtime_error("Error decoding "+mEntry.name+" in "+mFname);
+                mInputPos += inSize;
+                end = ret==0;
+            }
+#endif
+            produced += size;
+            if(end)
+                break;
+            if(size==0 && mInputPos==consumed && mInputLeft==0)
+                throw std::runtime_error("Truncated data for "+mEntry.name+" in "+mFname);
+        }
+        return produced;
+    }
+
+    int mFd;
+    const ZipEntry& mEntry;
+    const std::string& mFname;
+    uint64_t mDataOffset;
+    uint64_t mOffset;
+    uint64_t mInputLeft;
+    uint64_t mProduced;
+    bool mCheckCrc;
+    uLong mCrc;
+    InflateState* mState;
+    std::unique_ptr<InflateState> mOwnState;
+    std::vector<unsigned char> mInput;      //!< Compressed input of zstd and lz4
+    size_t mInputPos = 0;
+    size_t mInputEnd = 0;
+#ifdef CNPY_HAVE_ZSTD
+    std::unique_ptr<ZSTD_DCtx, size_t(*)(ZSTD_DCtx*)> mZstd{nullptr, ZSTD_freeDCtx};
+#endif
+#ifdef CNPY_HAVE_LZ4
+    std::unique_ptr<LZ4F_dctx, LZ4F_errorCode_t(*)(LZ4F_dctx*)> mLz4{nullptr, LZ4F_freeDecompressionContext};
+#endif
+};
+
+/**
+ * @brief Check that the uncompressed size of an entry is the size of its npy header and data
+ *
+ * The size in the central directory decides how much the decoders
+ * allocate: a size that the npy header of the entry does not explain is
+ * rejected before anything is allocated.
+ */
+static void checkNpyEntrySize(const ZipEntry& entry, const size_t headerSize, const size_t elemSize,
+                              const std::vector<size_t>& shape, const std::string& fname)
+{
+    uint64_t dataSize = elemSize;
+    bool overflow = false;
+    if(std::find(shape.begin(), shape.end(), 0)!=shape.end())
+        dataSize = 0;
+    for(const size_t n: shape)
+    {
+        if(dataSize>0 && n>std::numeric_limits<uint64_t>::max()/dataSize)
+            overflow = true;
+        dataSize *= n;
+    }
+    if(overflow || dataSize>std::numeric_limits<uint64_t>::max()-headerSize ||
+       headerSize+dataSize!=entry.uncompressedSize)
+        throw std::runtime_error("Size of "+entry.name+" in "+fname+" does not match its npy header");
+}
+
+/**
+ * @brief Turn the decoded bytes of a `npy` entry into an array, without copy
+ *
+ * The array data is moved over the npy header, in place.
+ */
+static cnpy::NpArray adoptNpyBuffer(std::unique_ptr<unsigned char[]>&& buffer, const size_t size,
+                                    const ZipEntry& entry, const std::string& fname)
+{
+    std::vector<size_t> shape;
+    size_t word_size;
+    bool fortran_order;
+    char elType;
+    const size_t headerSize = parseNpyBuffer(buffer.get(), size, word_size, shape, fortran_order, elType);
+    const size_t dataSize = std::accumulate(shape.cbegin(), shape.cend(), word_size, std::multiplies<size_t>());
+    if(size-headerSize<dataSize)
+        throw std::runtime_error("Entry "+entry.name+" in "+fname+" is truncated");
+    std::memmove(buffer.get(), buffer.get()+headerSize, dataSize);
+
+    return cnpy::NpArray(shape, word_size, descr2Type(elType, word_size), fortran_order, std::move(buffer));
+}
+
+#ifdef CNPY_HAVE_LIBDEFLATE
+/**
+ * @brief The libdeflate decompressor of the calling thread
+ */
+static struct libdeflate_decompressor* threadDecompressor()
+{
+    thread_local std::unique_ptr<struct libdeflate_decompressor, void(*)(struct libdeflate_decompressor*)>
+        decompressor(libdeflate_alloc_decompressor(), libdeflate_free_decompressor);
+    if(!decompressor)
+        throw std::runtime_error("Error allocating the deflate decoder");
+    return decompressor.get();
+}
+#endif
+
+#ifndef CNPY_HAVE_LIBDEFLATE
+/**
+ * @brief Inflate a raw deflate stream read from a file into a buffer of its exact size
+ *
+ * The decoder of the thread is reused. The compressed data is read in
+ * chunks of READ_CHUNK_SIZE bytes, so that only the output buffer is
+ * allocated at the size of the entry.
+ */
+static void inflateFile(const int fd, const uint64_t inputOffset, const uint64_t inputSize,
+                        unsigned char* output, const uint64_t outputSize,
+                        const ZipEntry& entry, const std::string& fname)
+{
+    InflateState& shared = threadInflateState();
+    std::unique_ptr<InflateState> own;
+    InflateState* state = &shared;
+    if(shared.busy)
+    {
+        own.reset(new InflateState());
+        state = own.get();
+    }
+
+    z_stream& stream = state->stream;
+    if(!state->initialized)
+    {
+        stream.zalloc = Z_NULL;
+        stream.zfree = Z_NULL;
+        stream.opaque = Z_NULL;
+        stream.next_in = Z_NULL;
+        stream.avail_in = 0;
+        if(inflateInit2(&stream, -MAX_WBITS)!=Z_OK)
+            throw std::runtime_error("Error initializing the decoder for "+entry.name+" in "+fname);
+        state->initialized = true;
+    }
+    else if(inflateReset(&stream)!=Z_OK)
+        throw std::runtime_error("Error initializing the decoder for "+entry.name+" in "+fname);
+
+    std::vector<unsigned char> input(std::min<uint64_t>(inputSize, READ_CHUNK_SIZE));
+    stream.next_in = input.data();
+    stream.avail_in = 0;
+    stream.next_out = output;
+    uint64_t offset = inputOffset;
+    uint64_t inputLeft = inputSize;
+    uint64_t outputLeft = outputSize;
+    int ret = Z_OK;
+    while(ret==Z_OK)
+    {
+        if(stream.avail_in==0)
+        {
+            if(inputLeft==0)
+                break;
+            const size_t len = std::min<uint64_t>(inputLeft, input.size());
+            preadAll(fd, input.data(), len, offset, fname);
+            offset += len;
+            inputLeft -= len;
+            stream.next_in = input.data();
+            stream.avail_in = len;
+        }
+
+        // avail_out is 32 bits wide: larger buffers take several calls
+        const uInt out = std::min<uint64_t>(outputLeft, std::numeric_limits<uInt>::max());
+        stream.avail_out = out;
+        ret = inflate(&stream, Z_NO_FLUSH);
+        outputLeft -= out - stream.avail_out;
+    }
+    if(ret!=Z_STREAM_END || outputLeft!=0)
+        throw std::runtime_error("Error decoding "+entry.name+" in "+fname);
+}
+#endif
+
+/**
+ * @brief Decode a deflated `npy` entry of known size in one go
+ *
+ * The whole entry is decoded into a buffer of its uncompressed size, whose
+ * agreement with the npy header the caller has checked. The array data is
+ * then moved over the npy header, in place, and the buffer is adopted by
+ * the array. With zlib the compressed data is streamed in chunks; libdeflate
+ * reads it with a single pread and decodes it with one call.
+ */
+static cnpy::NpArray inflateNpzEntry(const int fd, const ZipEntry& entry, const std::string& fname,
+                                     const uint64_t dataOffset, const bool checkCrc)
+{
+    if(entry.flags & 0x1)
+        throw std::runtime_error("Encrypted entry "+entry.name+" in "+fname+" is not supported");
+    if(entry.method!=ZIP_METHOD_DEFLATE)
+        throw std::runtime_error("Unsupported compression method for "+entry.name+" in "+fname);
+
+    std::unique_ptr<unsigned char[]> output(new unsigned char[entry.uncompressedSize]);
+
+#ifdef CNPY_HAVE_LIBDEFLATE
+    // libdeflate needs the whole compressed stream in memory
+    std::vector<unsigned char> input(entry.compressedSize);
+    preadAll(fd, input.data(), input.size(), dataOffset, fname);
+    size_t decoded;
+    if(libdeflate_deflate_decompress(threadDecompressor(), input.data(), input.size(),
+                                     output.get(), entry.uncompressedSize, &decoded)!=LIBDEFLATE_SUCCESS ||
+       decoded!=entry.uncompressedSize)
+        throw std::runtime_error("Error decoding "+entry.name+" in "+fname);
+    input = std::vector<unsigned char>();
+
+    if(checkCrc && libdeflate_crc32(0, output.get(), decoded)!=entry.crc)
+        throw std::runtime_error("CRC mismatch for "+entry.name+" in "+fname);
+#else
+    inflateFile(fd, dataOffset, entry.compressedSize, output.get(), entry.uncompressedSize, entry, fname);
+    const size_t decoded = entry.uncompressedSize;
+
+    if(checkCrc && crc32Update(0, output.get(), decoded)!=entry.crc)
+        throw std::runtime_error("CRC mismatch for "+entry.name+" in "+fname);
+#endif
+
+    return adoptNpyBuffer(std::move(output), decoded, entry, fname);
+}
+
+#ifdef CNPY_HAVE_ZSTD
+/**
+ * @brief The zstd decoder of the calling thread
+ */
+static ZSTD_DCtx* threadZstdDecoder()
+{
+    thread_local std::unique_ptr<ZSTD_DCtx, size_t(*)(ZSTD_DCtx*)> decoder(ZSTD_createDCtx(), ZSTD_freeDCtx);
+    if(!decoder)
+        throw std::runtime_error("Error allocating the zstd decoder");
+    return decoder.get();
+}
+#endif
+
+#ifdef CNPY_HAVE_LZ4
+/**
+ * @brief The lz4 decoder of the calling thread
+ */
+static LZ4F_dctx* threadLz4Decoder()
+{
+    thread_local std::unique_ptr<LZ4F_dctx, LZ4F_errorCode_t(*)(LZ4F_dctx*)> decoder(nullptr, LZ4F_freeDecompressionContext);
+    if(!decoder)
+    {
+        LZ4F_dctx* dctx;
+        if(LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)))
+            throw std::runtime_error("Error allocating the lz4 decoder");
+        decoder.reset(dctx);
+    }
+    return decoder.get();
+}
+#endif
+
+/**
+ * @brief Decode a zstd or lz4 `npy` entry of known size in one go
+ *
+ * The compressed payload is read with a single pread and decoded with one
+ * call into the buffer of the array.
+ */
+static cnpy::NpArray unpackNpzEntry(const int fd, const ZipEntry& entry, const std::string& fname,
+                                    const uint64_t dataOffset, const bool checkCrc)
+{
+    if(entry.flags & 0x1)
+        throw std::runtime_error("Encrypted entry "+entry.name+" in "+fname+" is not supported");
+    if(entry.method==ZIP_METHOD_STORE || !zipMethodSupported(entry.method))
+        throw std::runtime_error("Unsupported compression method for "+entry.name+" in "+fname);
+
+    std::vector<unsigned char> input(entry.compressedSize);
+    preadAll(fd, input.data(), input.size(), dataOffset, fname);
+
+    std::unique_ptr<unsigned char[]> output(new unsigned char[entry.uncompressedSize]);
+    bool decoded = false;
+#ifdef CNPY_HAVE_ZSTD
+    if(entry.method==ZIP_METHOD_ZSTD)
+    {
+        const size_t size = ZSTD_decompressDCtx(threadZstdDecoder(), output.get(), entry.uncompressedSize,
+                                                input.data(), input.size());
+        decoded = !ZSTD_isError(size) && size==entry.uncompressedSize;
+    }
+#endif
+#ifdef CNPY_HAVE_LZ4
+    if(entry.method==ZIP_METHOD_LZ4)
+    {
+        LZ4F_dctx* dctx = threadLz4Decoder();
+        LZ4F_resetDecompressionContext(dctx);
+        size_t size = entry.uncompressedSize;
+        size_t inSize = input.size();
+        // 0 once the whole frame is decoded
+        const size_t ret = LZ4F_decompress(dctx, output.get(), &size, input.data(), &inSize, nullptr);
+        decoded = ret==0 && size==entry.uncompressedSize;
+    }
+#endif
+    if(!decoded)
+        throw std::runtime_error("Error decoding "+entry.name+" in "+fname);
+    input = std::vector<unsigned char>();
+
+    if(checkCrc && crc32Update(0, output.get(), entry.uncompressedSize)!=entry.crc)
+        throw std::runtime_error("CRC mismatch for "+entry.name+" in "+fname);
+
+    return adoptNpyBuffer(std::move(output), entry.uncompressedSize, entry, fname);
+}
+
+/**
+ * @brief Decode a compressed `npy` entry of known size in one go, and undo its filter
+ */
+static cnpy::NpArray decodeNpzEntry(const int fd, const ZipEntry& entry, const std::string& fname,
+                                    const uint64_t dataOffset, const bool checkCrc)
+{
+    zipEntryFilter(entry, fname);
+    cnpy::NpArray arr = entry.method==ZIP_METHOD_DEFLATE ? inflateNpzEntry(fd, entry, fname, dataOffset, checkCrc) :
+                                                           unpackNpzEntry(fd, entry, fname, dataOffset, checkCrc);
+    unfilterNpzData(entry, arr.data(), arr.size(), fname);
+    return arr;
+}
+
+/**
+ * @brief Decode a `npy` entry of a zip archive
+ */
+static cnpy::NpArray loadNpzEntry(const int fd, const ZipEntry& entry, const std::string& fname)
+{
+    const uint64_t dataOffset = zipEntryDataOffset(fd, entry, fname);
+    if(entry.method!=ZIP_METHOD_STORE)
+    {
+        // Decode the npy header alone to check the size before the output is allocated
+        ZipEntryReader peek(fd, entry, fname, dataOffset, false, NPZ_PEEK_SIZE);
+        size_t headerSize;
+        const std::string dict = readNpyDict([&peek](void* buffer, size_t len) {
+            return peek.read(buffer, len);
+        }, headerSize);
+
+        std::vector<size_t> shape;
+        size_t word_size;
+        bool fortran_order;
+        char elType;
+        parseDictHeader(dict, word_size, shape, fortran_order, elType);
+        checkNpyEntrySize(entry, headerSize, word_size, shape, fname);
+
+        return decodeNpzEntry(fd, entry, fname, dataOffset, true);
+    }
+
+    ZipEntryReader reader(fd, entry, fname, dataOffset);
+
+    size_t headerSize;
+    const std::string dict = readNpyDict([&reader](void* buffer, size_t len) {
+        return reader.read(buffer, len);
+    }, headerSize);
+
+    std::vector<size_t> shape;
+    size_t word_size;
+    bool fortran_order;
+    char elType;
+    parseDictHeader(dict, word_size, shape, fortran_order, elType);
+
+    cnpy::NpArray arr(shape, word_size, descr2Type(elType, word_size), fortran_order);
+    const size_t nread = reader.read(arr.data(), arr.size());
+    if(nread!=arr.size())
+        throw std::runtime_error("npy file read error: expected "+std::to_string(arr.size())+", read "+std::to_string(nread));
+
+    return arr;
+}
+
+
+/**
+ * @brief Map a `npy` entry of an opened npz archive
+ *
+ * Stored entries become views on `mapping`; compressed entries are decoded
+ * in memory.
+ */
+static cnpy::NpArray mapNpzEntry(const int fd, const ZipEntry& entry,
+                                 const std::shared_ptr<cnpy::MemoryMap>& mapping,
+                                 const std::string& fname)
+{
+    if(entry.flags & 0x1)
+        throw std::runtime_error("Encrypted entry "+entry.name+" in "+fname+" is not supported");
+
+    // Compressed data can not be mapped: decode it in memory
+    if(entry.method!=ZIP_METHOD_STORE)
+        return loadNpzEntry(fd, entry, fname);
+
+    const uint64_t offset = zipEntryDataOffset(fd, entry, fname);
+    if(offset+entry.uncompressedSize>mapping->size())
+        throw std::runtime_error("Entry "+entry.name+" exceeds the size of "+fname);
+
+    std::vector<size_t> shape;
+    size_t word_size;
+    bool fortran_order;
+    char elType;
+    const size_t dataOffset = parseNpyBuffer(mapping->data()+offset, entry.uncompressedSize,
+                                             word_size, shape, fortran_order, elType);
+
+    cnpy::NpArray arr(shape, word_size, descr2Type(elType, word_size), fortran_order,
+                      mapping, mapping->data()+offset+dataOffset);
+    if(entry.uncompressedSize-dataOffset<arr.size())
+        throw std::runtime_error("Entry "+entry.name+" in "+fname+" is truncated");
 
     return arr;
 }
 
+/**
+ * @brief Map the npz entries in `entries`
+ */
+static cnpy::NpArrayDict mapNpzEntries(const std::string& fname, const cnpy::MapMode mode,
+                                       const std::vector<ZipEntry>& entries, const int fd)
+{
+    std::shared_ptr<cnpy::MemoryMap> mapping = std::make_shared<cnpy::MemoryMap>(fd, fname, mode);
+
+    cnpy::NpArrayDict arrays;
+    for(const ZipEntry& entry: entries)
+    {
+        std::string name = entry.name;
+        name.erase(name.size()-4);
+        arrays.insert(NpArrayDictItem(name, mapNpzEntry(fd, entry, mapping, fname)));
+    }
+
+    return arrays;
+}
+
+static bool isNpyEntry(const ZipEntry& entry)
+{
+    return entry.name.size()>=4 && entry.name.compare(entry.name.size()-4, 4, ".npy")==0;
+}
+
+cnpy::NpArrayDict cnpy::npz_mmap(const std::string& fname, const MapMode mode)
+{
+    // Writing to a stored entry would invalidate its CRC
+    if(mode==MapMode::ReadWrite)
+        throw std::runtime_error("npz files can not be mapped with MapMode::ReadWrite");
+
+    FileDescriptor fd(::open(fname.c_str(), O_RDONLY));
+    if(fd.handle()<0)
+        throw std::runtime_error("Error opening npz file "+fname);
+
+    ZipDirectory dir = readZipDirectory(fd.handle(), fname);
+    dir.entries.erase(std::remove_if(dir.entries.begin(), dir.entries.end(),
+                                     [](const ZipEntry& e) { return !isNpyEntry(e); }),
+                      dir.entries.end());
+
+    return mapNpzEntries(fname, mode, dir.entries, fd.handle());
+}
+
+cnpy::NpArray cnpy::npz_mmap(const std::string& fname, const std::string& varname, const MapMode mode)
+{
+    if(mode==MapMode::ReadWrite)
+        throw std::runtime_error("npz files can not be mapped with MapMode::ReadWrite");
+
+    FileDescriptor fd(::open(fname.c_str(), O_RDONLY));
+    if(fd.handle()<0)
+        throw std::runtime_error("Error opening npz file "+fname);
+
+    const ZipDirectory dir = readZipDirectory(fd.handle(), fname);
+
+    const std::string key = varname + ".npy";
+    for(const ZipEntry& entry: dir.entries)
+    {
+        if(entry.name==key)
+        {
+            NpArrayDict arrays = mapNpzEntries(fname, mode, std::vector<ZipEntry>(1, entry), fd.handle());
+            return std::move(arrays.begin()->second);
+        }
+    }
+
+    throw std::runtime_error("Variable name "+varname+" not found in "+fname);
+}
+
+
+/**
+ * @brief Read the rows selected by `slices` of a `npy` entry of a zip archive
+ *
+ * Stored entries are read in place; compressed entries are decoded up to the
+ * last selected row, starting from the closest restart point of the entry.
+ */
+static cnpy::NpArray readNpzEntrySlice(const int fd, const std::string& fname, const ZipEntry& entry,
+                                       const uint64_t dataOffset, const std::vector<cnpy::Slice>& slices,
+                                       const bool checkCrc)
+{
+    if(entry.flags & 0x1)
+        throw std::runtime_error("Encrypted entry "+entry.name+" in "+fname+" is not supported");
+
+    std::vector<size_t> shape;
+    size_t word_size;
+    bool fortran_order;
+    char elType;
+
+    if(entry.method==ZIP_METHOD_STORE)
+    {
+        // The rows are read in place, right after the npy header
+        uint64_t offset = dataOffset;
+        size_t headerSize;
+        const std::string dict = readNpyDict([fd, &fname, &offset](void* buffer, size_t len) {
+            preadAll(fd, buffer, len, offset, fname);
+            offset += len;
+            return len;
+        }, headerSize);
+        parseDictHeader(dict, word_size, shape, fortran_order, elType);
+
+        return preadSlice(fd, fname, dataOffset+headerSize, shape, word_size,
+                          descr2Type(elType, word_size), fortran_order, slices);
+    }
+
+    // Compressed data can only be decoded sequentially: skip what comes before the rows
+    ZipEntryReader reader(fd, entry, fname, dataOffset, checkCrc);
+    size_t headerSize;
+    const std::string dict = readNpyDict([&reader](void* buffer, size_t len) {
+        return reader.read(buffer, len);
+    }, headerSize);
+    parseDictHeader(dict, word_size, shape, fortran_order, elType);
+
+    const std::vector<SeekPoint>& seekPoints = entry.seekPoints;
+    // Decoded bytes [offset, offset+size) of the array data, in increasing order
+    uint64_t position = 0;
+    std::vector<unsigned char> scratch;
+    const auto read = [&](unsigned char* dst, uint64_t offset, uint64_t size) {
+        // Jump to the last restart point before the data, if it is ahead
+        const std::vector<SeekPoint>::const_iterator point = std::upper_bound(
+            seekPoints.begin(), seekPoints.end(), headerSize+offset,
+            [](uint64_t target, const SeekPoint& p) { return target<p.uncompressedOffset; });
+        if(point!=seekPoints.begin() && std::prev(point)->uncompressedOffset>headerSize+position)
+        {
+            reader.seek(*std::prev(point));
+            position = std::prev(point)->uncompressedOffset - headerSize;
+        }
+
+        while(position<offset)
+        {
+            scratch.resize(std::min<uint64_t>(offset-position, ZIP_COPY_BUFFER_SIZE));
+            const size_t nread = reader.read(scratch.data(), std::min<uint64_t>(offset-position, scratch.size()));
+            if(nread==0)
+                throw std::runtime_error("Error decoding "+entry.name+" in "+fname);
+            position += nread;
+        }
+        if(reader.read(dst, size)!=size)
+            throw std::runtime_error("Error decoding "+entry.name+" in "+fname);
+        position += size;
+    };
+
+    const cnpy::Filter filter = zipEntryFilter(entry, fname);
+    if(filter==cnpy::Filter::None)
+        return readSlice(shape, word_size, descr2Type(elType, word_size), fortran_order, slices, read);
+
+    // Filtered data is decoded and unfiltered a whole block at a time
+    const size_t dataSize = std::accumulate(shape.cbegin(), shape.cend(), word_size, std::multiplies<size_t>());
+    const size_t blockSize = filterBlockSize(entry.filterElemSize);
+    std::vector<unsigned char> block, plain, blockScratch;
+    uint64_t blockBegin = 0;
+    uint64_t blockEnd = 0;
+    return readSlice(shape, word_size, descr2Type(elType, word_size), fortran_order, slices,
+                     [&](unsigned char* dst, uint64_t offset, uint64_t size) {
+        while(size>0)
+        {
+            if(offset<blockBegin || offset>=blockEnd)
+            {
+                blockBegin = offset / blockSize * blockSize;
+                blockEnd = std::min<uint64_t>(blockBegin+blockSize, dataSize);
+                block.resize(blockEnd-blockBegin);
+                plain.resize(block.size());
+                blockScratch.resize(block.size());
+                read(block.data(), blockBegin, block.size());
+                unfilterBlock(filter, entry.filterElemSize, block.data(), block.size()/entry.filterElemSize,
+                              plain.data(), blockScratch.data());
+            }
+            const uint64_t len = std::min(size, blockEnd-offset);
+            std::memcpy(dst, &plain[offset-blockBegin], len);
+            dst += len;
+            offset += len;
+            size -= len;
+        }
+    });
+}
+
+/**
+ * @brief Location of the arrays of an archive, built when it is opened
+ */
+struct cnpy::NpzArchive::Index
+{
+    struct Item
+    {
+        ZipEntry entry;
+        uint64_t dataOffset;    //!< Offset of the entry data, after the local header
+        size_t headerSize;      //!< Size of the npy header
+        uLong headerCrc;        //!< CRC of the npy header of stored entries
+    };
+
+    std::vector<NpzArrayInfo> arrays;
+    std::vector<Item> items;
+    std::map<std::string, size_t> positions;
+};
+
+
+cnpy::NpzArchive::NpzArchive(const std::string& fname, const bool checkConsistency) :
+    mFname(fname),
+    mFd(-1),
+    mCheckConsistency(checkConsistency)
+{
+    mFd = ::open(fname.c_str(), O_RDONLY);
+    if(mFd<0)
+        throw std::runtime_error("Error opening npz file "+fname);
+
+    try
+    {
+        mIndex = readIndex();
+    }
+    catch(...)
+    {
+        ::close(mFd);
+        throw;
+    }
+}
+
+cnpy::NpzArchive::~NpzArchive()
+{
+    ::close(mFd);
+}
+
+std::shared_ptr<const cnpy::NpzArchive::Index> cnpy::NpzArchive::readIndex() const
+{
+    const ZipDirectory dir = readZipDirectory(mFd, mFname);
+    std::shared_ptr<Index> index = std::make_shared<Index>();
+
+    std::vector<unsigned char> window;
+    for(const ZipEntry& entry: dir.entries)
+    {
+        if(!isNpyEntry(entry))
+            continue;
+        if(entry.flags & 0x1)
+            throw std::runtime_error("Encrypted entry "+entry.name+" in "+mFname+" is not supported");
+        if(entry.headerOffset+ZIP_LOCAL_HEADER_SIZE>dir.offset)
+            throw std::runtime_error("Invalid local header for "+entry.name+" in "+mFname);
+
+        // A single read usually covers the local header and the npy header
+        window.resize(std::min(NPZ_PEEK_SIZE, dir.offset-entry.headerOffset));
+        preadAll(mFd, window.data(), window.size(), entry.headerOffset, mFname);
+        const unsigned char* local = window.data();
+        if(readLE32(local)!=ZIP_LOCAL_HEADER_SIGNATURE)
+            throw std::runtime_error("Invalid local header for "+entry.name+" in "+mFname);
+        const size_t nameSize = readLE16(local+26);
+
+        Index::Item item;
+        item.entry = entry;
+        item.dataOffset = entry.headerOffset + ZIP_LOCAL_HEADER_SIZE + nameSize + readLE16(local+28);
+        item.headerCrc = 0;
+
+        if(mCheckConsistency)
+        {
+            // The local header must describe the same entry as the central directory
+            const bool sameName = ZIP_LOCAL_HEADER_SIZE+nameSize<=window.size() &&
+                entry.name.compare(0, std::string::npos, reinterpret_cast<const char*>(local+ZIP_LOCAL_HEADER_SIZE), nameSize)==0;
+            const uint32_t compressedSize = readLE32(local+18);
+            const uint32_t uncompressedSize = readLE32(local+22);
+            const bool sameSizes = (entry.flags & 0x0008) ||
+                ((readLE32(local+14)==entry.crc) &&
+                 (compressedSize==ZIP32_LIMIT || compressedSize==entry.compressedSize) &&
+                 (uncompressedSize==ZIP32_LIMIT || uncompressedSize==entry.uncompressedSize));
+            if(!sameName || readLE16(local+8)!=zipHeaderMethod(entry) || !sameSizes)
+                throw std::runtime_error("Local header of "+entry.name+" does not match the central directory of "+mFname);
+            if(item.dataOffset+entry.compressedSize>dir.offset)
+                throw std::runtime_error("Entry "+entry.name+" overlaps the central directory of "+mFname);
+        }
+
+        std::string dict;
+        if(entry.method==ZIP_METHOD_STORE)
+        {
+            const uint64_t windowEnd = entry.headerOffset + window.size();
+            const uint64_t dataEnd = item.dataOffset + entry.compressedSize;
+            uint64_t offset = item.dataOffset;
+            dict = readNpyDict([&](void* buffer, size_t len) {
+                len = std::min<uint64_t>(len, dataEnd-std::min(offset, dataEnd));
+                if(offset+len<=windowEnd)
+                    std::memcpy(buffer, &window[offset-entry.headerOffset], len);
+                else
+                    preadAll(mFd, buffer, len, offset, mFname);
+                item.headerCrc = crc32Update(item.headerCrc, buffer, len);
+                offset += len;
+                return len;
+            }, item.headerSize);
+        }
+        else
+        {
+            ZipEntryReader reader(mFd, entry, mFname, item.dataOffset, false, NPZ_PEEK_SIZE);
+            dict = readNpyDict([&reader](void* buffer, size_t len) {
+                return reader.read(buffer, len);
+            }, item.headerSize);
+        }
+
+        NpzArrayInfo info;
+        info.name = entry.name.substr(0, entry.name.size()-4);
+        char elType;
+        parseDictHeader(dict, info.elemSize, info.shape, info.fortranOrder, elType);
+        info.dtype = descr2Type(elType, info.elemSize);
+        info.compressed = entry.method!=ZIP_METHOD_STORE;
+        if(info.compressed)
+            checkNpyEntrySize(entry, item.headerSize, info.elemSize, info.shape, mFname);
+
+        index->positions[info.name] = index->items.size();
+        index->arrays.push_back(info);
+        index->items.push_back(item);
+    }
+
+    return index;
+}
+
+const std::vector<cnpy::NpzArrayInfo>& cnpy::NpzArchive::arrays() const
+{
+    return mIndex->arrays;
+}
+
+bool cnpy::NpzArchive::contains(const std::string& name) const
+{
+    return mIndex->positions.count(name)>0;
+}
+
+const cnpy::NpzArrayInfo& cnpy::NpzArchive::info(const std::string& name) const
+{
+    return mIndex->arrays[position(name)];
+}
+
+size_t cnpy::NpzArchive::position(const std::string& name) const
+{
+    const std::map<std::string, size_t>::const_iterator it = mIndex->positions.find(name);
+    if(it==mIndex->positions.end())
+        throw std::runtime_error("Variable name "+name+" not found in "+mFname);
+    return it->second;
+}
+
+cnpy::NpArray cnpy::NpzArchive::load(const std::string& name) const
+{
+    return loadAt(position(name));
+}
+
+cnpy::NpArray cnpy::NpzArchive::loadAt(const size_t i) const
+{
+    const NpzArrayInfo& info = mIndex->arrays[i];
+    const Index::Item& item = mIndex->items[i];
+    const ZipEntry& entry = item.entry;
+
+    if(entry.method==ZIP_METHOD_STORE)
+    {
+        NpArray arr(info.shape, info.elemSize, info.dtype, info.fortranOrder);
+
+        // The location of the data is known: a single read
+        if(item.headerSize+arr.size()>entry.compressedSize)
+            throw std::runtime_error("Entry "+entry.name+" in "+mFname+" is truncated");
+        preadAll(mFd, arr.data(), arr.size(), item.dataOffset+item.headerSize, mFname);
+
+        if(mCheckConsistency && item.headerSize+arr.size()==entry.uncompressedSize)
+        {
+            const uLong crc = crc32_combine(item.headerCrc, crc32Update(0, arr.data(), arr.size()), arr.size());
+            if(crc!=entry.crc)
+                throw std::runtime_error("CRC mismatch for "+entry.name+" in "+mFname);
+        }
+        return arr;
+    }
+
+    return decodeNpzEntry(mFd, entry, mFname, item.dataOffset, mCheckConsistency);
+}
+
+cnpy::NpArrayDict cnpy::NpzArchive::loadAll(const unsigned numThreads) const
+{
+    // Largest entries first, so that a big array does not start last and
+    // leave a single thread working at the end
+    std::vector<size_t> order(mIndex->items.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return mIndex->items[a].entry.uncompressedSize>mIndex->items[b].entry.uncompressedSize;
+    });
+
+    std::vector<NpArray> arrays(order.size());
+    parallelFor(order.size(), threadCount(numThreads), [&](size_t i) {
+        arrays[i] = loadAt(order[i]);
+    });
+
+    NpArrayDict dict;
+    for(size_t i=0; i<order.size(); ++i)
+        dict.insert(NpArrayDictItem(mIndex->arrays[order[i]].name, std::move(arrays[i])));
+
+    return dict;
+}
+
+cnpy::NpArray cnpy::NpzArchive::loadRows(const std::string& name, const size_t first, const size_t count) const
+{
+    const Index::Item& item = mIndex->items[position(name)];
+    return readNpzEntrySlice(mFd, mFname, item.entry, item.dataOffset,
+                             std::vector<Slice>(1, rowSlice(first, count)), mCheckConsistency);
+}
+
+
+cnpy::NpArrayDict cnpy::npz_load(const std::string& fname)
+{
+    return NpzArchive(fname).loadAll();
+}
+
+cnpy::NpArray cnpy::npz_load(const std::string& fname, const std::string& varname)
+{
+    // Only the requested entry is read, without peeking the others
+    FileDescriptor fd(::open(fname.c_str(), O_RDONLY));
+    if(fd.handle()<0)
+        throw std::runtime_error("Error opening npz file "+fname);
+
+    const ZipDirectory dir = readZipDirectory(fd.handle(), fname);
+    const std::string key = varname + ".npy";
+    std::vector<ZipEntry>::const_iterator entry = std::find_if(dir.entries.begin(), dir.entries.end(),
+                                                               [&key](const ZipEntry& e) { return e.name==key; });
+    if(entry==dir.entries.end())
+        throw std::runtime_error("Variable name "+varname+" not found in "+fname);
+
+    return loadNpzEntry(fd.handle(), *entry, fname);
+}
+
+cnpy::NpArrayDict cnpy::npz_load_parallel(const std::string& fname, const unsigned numThreads)
+{
+    return NpzArchive(fname).loadAll(numThreads);
+}
+
+cnpy::NpArray cnpy::npz_load_rows(const std::string& fname, const std::string& varname,
+                                  const size_t first, const size_t count)
+{
+    FileDescriptor fd(::open(fname.c_str(), O_RDONLY));
+    if(fd.handle()<0)
+        throw std::runtime_error("Error opening npz file "+fname);
+
+    const ZipDirectory dir = readZipDirectory(fd.handle(), fname);
+    const std::string key = varname + ".npy";
+    std::vector<ZipEntry>::const_iterator entry = std::find_if(dir.entries.begin(), dir.entries.end(),
+                                                               [&key](const ZipEntry& e) { return e.name==key; });
+    if(entry==dir.entries.end())
+        throw std::runtime_error("Variable name "+varname+" not found in "+fname);
+
+    return readNpzEntrySlice(fd.handle(), fname, *entry, zipEntryDataOffset(fd.handle(), *entry, fname),
+                             std::vector<Slice>(1, rowSlice(first, count)), true);
+}
+
+
+cnpy::NpzCache::NpzCache(const size_t budget) :
+    mBudget(budget),
+    mBytes(0)
+{}
+
+cnpy::NpzCache::FileId cnpy::NpzCache::identify(const std::string& fname)
+{
+    struct stat st;
+    if(::stat(fname.c_str(), &st)!=0)
+        throw std::runtime_error("Error opening npz file "+fname);
+
+    FileId id;
+    id.dev = st.st_dev;
+    id.ino = st.st_ino;
+    id.size = st.st_size;
+    id.mtimeSec = st.st_mtim.tv_sec;
+    id.mtimeNsec = st.st_mtim.tv_nsec;
+    return id;
+}
+
+std::shared_ptr<const cnpy::NpArray> cnpy::NpzCache::load(const std::string& fname, const std::string& name)
+{
+    const std::pair<std::string, std::string> key(fname, name);
+    const FileId file = identify(fname);
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        const auto it = mLookup.find(key);
+        if(it!=mLookup.end())
+        {
+            if(it->second->file==file)
+            {
+                mItems.splice(mItems.begin(), mItems, it->second);
+                return it->second->array;
+            }
+            erase(it->second);
+        }
+    }
+
+    // Decode without holding the lock, so that hits are not blocked by a miss
+    std::shared_ptr<const NpArray> array = std::make_shared<NpArray>(npz_load(fname, name));
+    if(array->size()>mBudget)
+        return array;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    const auto it = mLookup.find(key);
+    if(it!=mLookup.end())
+    {
+        // Loaded by another thread in the meantime
+        if(it->second->file==file)
+            return it->second->array;
+        erase(it->second);
+    }
+
+    Item item;
+    item.key = key;
+    item.file = file;
+    item.array = array;
+    mItems.push_front(item);
+    mLookup[key] = mItems.begin();
+    mBytes += array->size();
+
+    while(mBytes>mBudget)
+        erase(std::prev(mItems.end()));
+
+    return array;
+}
+
+void cnpy::NpzCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mItems.clear();
+    mLookup.clear();
+    mBytes = 0;
+}
 
+size_t cnpy::NpzCache::bytes() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mBytes;
+}
 
+void cnpy::NpzCache::erase(const ItemList::iterator it)
+{
+    mBytes -= it->array->size();
+    mLookup.erase(it->key);
+    mItems.erase(it);
+}
@@ -20,6 +20,14 @@
 #include <algorithm>
 #include <iostream>
 #include <climits>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <list>
+#include <mutex>
 
 
 namespace cnpy
@@ -99,6 +107,20 @@ template<typename _Tp> static Type type()
     return cnpy::Type::Void;
 }
 
+/**
+ * @brief Access modes of a memory mapped file, equivalent to the numpy
+ *        `mmap_mode` values.
+ */
+enum class MapMode
+{
+    ReadOnly,   //!< Read-only access (numpy `'r'`)
+    ReadWrite,  //!< Changes are written back to the file (numpy `'r+'`)
+    CopyOnWrite //!< Changes stay in memory and never reach the file (numpy `'c'`)
+};
+
+class MemoryMap;
+class ZipWriter;
+
 /**
  * @brief The NpArray class
  *
@@ -122,6 +144,11 @@ template<typename _Tp> static Type type()
  * Do not use NpArray::data() if the data ownership has been revoked from the
  * NpArray class instance.
  *
+ * An NpArray returned by npy_mmap() does not own a buffer: its data points
+ * into a mapping of the file, which is released when the last array
+ * referencing it is destroyed. Writing through NpArray::data() of an array
+ * mapped with MapMode::ReadOnly is undefined behaviour.
+ *
  */
 class NpArray
 {
@@ -164,10 +191,60 @@ public:
             std::memcpy(mData, data, mDataSize);
     }
 
+    /**
+     * @brief Constructor for a NpArray that takes ownership of a buffer
+     * @param shape Shape of the data
+     * @param elSize Size of each element
+     * @param dataType Type of each element
+     * @param isFortran true if the data is in fortran order (col-majour)
+     * @param data Buffer allocated with `new[]`, holding at least the data of the array
+     */
+    NpArray(const std::vector<size_t>& shape,
+            const size_t elSize,
+            const Type dataType,
+            const bool isFortran,
+            std::unique_ptr<unsigned char[]>&& data) :
+        mData(data.release()),
+        mShape(shape),
+        mElemSize(elSize),
+        mIsFortranOrder(isFortran),
+        mDtype(dataType),
+        mHasDataOwnership(true)
+    {
+        mDataSize = std::accumulate(mShape.begin(), mShape.end(), mElemSize, std::multiplies<size_t>());
+    }
+
+    /**
+     * @brief Constructor for a NpArray that views memory of a file mapping
+     * @param shape Shape of the data
+     * @param elSize Size of each element
+     * @param dataType Type of each element
+     * @param isFortran true if the data is in fortran order (col-majour)
+     * @param mapping The mapping that holds the data
+     * @param data Pointer to the first element inside the mapping
+     *
+     * The data is not copied: the array keeps the mapping alive.
+     */
+    NpArray(const std::vector<size_t>& shape,
+            const size_t elSize,
+            const Type dataType,
+            const bool isFortran,
+            const std::shared_ptr<MemoryMap>& mapping,
+            unsigned char* data) :
+        mData(data),
+        mShape(shape),
+        mElemSize(elSize),
+        mIsFortranOrder(isFortran),
+        mDtype(dataType),
+        mHasDataOwnership(true),
+        mMapping(mapping)
+    {
+        mDataSize = std::accumulate(mShape.begin(), mShape.end(), mElemSize, std::multiplies<size_t>());
+    }
+
     ~NpArray()
     {
-        if(mHasDataOwnership && mData!=nullptr)
-            delete[] mData;
+        release();
     }
 
     NpArray(NpArray&& other)
@@ -177,7 +254,11 @@ public:
 
     NpArray& operator=(NpArray&& other)
     {
-        move(other);
+        if(this!=&other)
+        {
+            release();
+            move(other);
+        }
         return *this;
     }
 
@@ -251,8 +332,31 @@ public:
     /**
      * @brief Revoke the responsibility of deleting internal data from the
      *        NpArray instance
+     * @throws std::runtime_error If the data belongs to a file mapping
+     */
+    void revokeDataOwnership()
+    {
+        if(mMapping)
+            throw std::runtime_error("The data of a memory mapped NpArray can not be revoked");
+        mHasDataOwnership = false;
+    }
+
+    /**
+     * @brief Check if the data is a view on a memory mapped file
+     * @return true if the NpArray data points into a file mapping
      */
-    void revokeDataOwnership() { mHasDataOwnership = false; }
+    bool isMapped() const { return static_cast<bool>(mMapping); }
+
+    /**
+     * @brief Write the changes of a MapMode::ReadWrite mapped array to its file
+     * @param async If true schedule the write and return immediately,
+     *        otherwise wait until the data reached the file
+     * @throws std::runtime_error If the synchronization fails
+     *
+     * The call does nothing for arrays that are not mapped or whose
+     * mapping is not MapMode::ReadWrite.
+     */
+    void flush(const bool async=false);
 
     /**
      * @brief Check if the NpArray instance is empty
@@ -264,6 +368,14 @@ public:
 
 private:
 
+    void release()
+    {
+        if(mHasDataOwnership && mData!=nullptr && !mMapping)
+            delete[] mData;
+        mData = nullptr;
+        mMapping.reset();
+    }
+
     void move(NpArray& other)
     {
         mData = other.mData;
@@ -274,11 +386,19 @@ private:
         mElemSize = other.mElemSize;
         other.mElemSize = 0;
 
+        mDataSize = other.mDataSize;
+        other.mDataSize = 0;
+
         mIsFortranOrder = other.mIsFortranOrder;
         other.mIsFortranOrder = false;
 
+        mDtype = other.mDtype;
+        other.mDtype = Type::Void;
+
         mHasDataOwnership = other.mHasDataOwnership;
         other.mHasDataOwnership = false;
+
+        mMapping = std::move(other.mMapping);
     }
 
     unsigned char* mData;
@@ -289,41 +409,753 @@ private:
     Type mDtype;
 
     bool mHasDataOwnership;
+    std::shared_ptr<MemoryMap> mMapping;
 };
 
 
 typedef std::map<std::string, NpArray> NpArrayDict;
 
+/**
+ * @brief Selection of indices along one axis, as the python slice `start:stop:step`
+ *
+ * The default Slice selects the whole axis. `stop` is clamped to the size
+ * of the axis.
+ */
+struct Slice
+{
+    Slice(const size_t start=0,
+          const size_t stop=std::numeric_limits<size_t>::max(),
+          const size_t step=1) :
+        start(start),
+        stop(stop),
+        step(step)
+    {}
+
+    size_t start;   //!< First index
+    size_t stop;    //!< One past the last index
+    size_t step;    //!< Distance between selected indices, greater than 0
+};
+
+/**
+ * @brief Compression of the arrays written into a `npz` archive
+ */
+enum class Compression
+{
+    None,       //!< Stored as is, as `numpy.savez`
+    Deflate,    //!< Deflate, as `numpy.savez_compressed`
+    Zstd,       //!< Zstandard (zip method 93), if built with zstd; numpy can not read it
+    Lz4,        //!< LZ4 frames (cnpy specific zip method), if built with lz4; numpy can not read it
+    Auto        //!< Stored or deflated with the level chosen from samples of the array
+};
+
+/**
+ * @brief Reordering of the bytes of a compressed array before compression
+ *
+ * As in Blosc, the bytes of the elements are regrouped by significance,
+ * which compresses numeric data much better. The data is filtered in
+ * blocks of about 256 KB and the filter is recorded in the entry, cnpy
+ * undoes it on load. Filtered entries are written with a compression method
+ * of their own, so that numpy refuses them instead of returning the
+ * shuffled bytes.
+ */
+enum class Filter
+{
+    None,
+    Shuffle,    //!< Byte i of the elements together, for each i
+    BitShuffle  //!< Bit i of the elements together, for each i
+};
+
+/**
+ * @brief Options controlling how an array is written into a `npz` archive.
+ *
+ * The options are checked before the archive is touched: invalid ones
+ * throw std::runtime_error and leave the archive unchanged.
+ */
+struct NpzSaveOptions
+{
+    /**
+     * @brief Compression of the array
+     *
+     * With Compression::Auto, a few blocks spread over the array are
+     * compressed first. Arrays that barely shrink (random data, hashes)
+     * are stored, the others are deflated at the fastest level, or at the
+     * default one if it does noticeably better on the samples. A level
+     * other than -1 is used as is for deflated arrays.
+     */
+    Compression compression = Compression::None;
+
+    /**
+     * @brief Compression level, from 1 (fastest) to 9 (smallest), up to 22 with zstd and 12 with lz4;
+     *        -1 selects the default of the codec
+     */
+    int level = -1;
+
+    /**
+     * @brief Threads compressing the array, 0 for one per hardware thread, at most 1024
+     *
+     * Deflated arrays larger than 1 MB are then cut into blocks compressed
+     * in parallel and joined into a single deflate stream, as pigz does.
+     * Zstd arrays are compressed by the worker threads of libzstd.
+     */
+    unsigned numThreads = 1;
+
+    /**
+     * @brief Filter applied to the array before compression, ignored for stored arrays
+     */
+    Filter filter = Filter::None;
+
+    /**
+     * @brief Mantissa bits kept in float arrays, -1 to keep them all
+     *
+     * The mantissas of Float, Double, ComplexFloat and ComplexDouble arrays
+     * are rounded to the nearest value with `mantissaBits` explicit bits
+     * (ties to even, NaN and infinities untouched) before being written.
+     * The zeroed low bits make the array compress much better while it
+     * stays an ordinary float array that numpy reads as usual; the relative
+     * error is at most 2^-(mantissaBits+1). Ignored for other types.
+     */
+    int mantissaBits = -1;
+
+    /**
+     * @brief If not null, raised to the largest absolute error introduced by mantissaBits
+     *
+     * The value pointed to is only ever increased, so it should be set to 0
+     * before the first array whose error is wanted. The error is measured
+     * on the blocks as they are rounded for writing, without another pass
+     * over the array. When these options are the default options of an
+     * NpzWriter, every array added with them raises the same value: pass
+     * options to NpzWriter::add() to get the error of one array.
+     */
+    double* maxError = nullptr;
+
+    /**
+     * @brief Rows of a deflated array between two restart points, 0 for none
+     *
+     * The encoder is reset every `seekRows` rows along the first axis and
+     * the restart points are saved in a private extra field of the central
+     * directory record of the array, which numpy does not see. Row reads
+     * (npz_load_rows(), NpzArchive::loadRows()) then start decoding from the
+     * closest restart point instead of from the beginning. An array gets at
+     * most 4000 restart points: for longer arrays the interval is widened
+     * to the smallest number of rows that keeps them under that limit.
+     */
+    size_t seekRows = 0;
+
+    /**
+     * @brief Alignment in bytes of the array data inside the archive.
+     *
+     * When greater than 1 the local header of the entry gets a padding extra
+     * field (the same used by Android zipalign) so that the data following
+     * the npy header starts at a multiple of `alignment` from the beginning
+     * of the file: mapped arrays are then aligned for SIMD loads (e.g. 64)
+     * or for O_DIRECT reads (e.g. 4096). At most 32768. Ignored for
+     * compressed arrays.
+     */
+    size_t alignment = 0;
+};
+
 NpArrayDict npz_load(const std::string& fname);
 NpArray npz_load(const std::string& fname, const std::string& varname);
 NpArray npy_load(const std::string& fname);
 
+/**
+ * @brief Load all the arrays of a `npz` file, decoding them on several threads
+ *
+ * The central directory is read once and the entries are decoded
+ * concurrently, the largest first.
+ *
+ * @param fname Path of the `npz` file
+ * @param numThreads Number of threads, 0 to use one per hardware thread
+ */
+NpArrayDict npz_load_parallel(const std::string& fname, const unsigned numThreads=0);
+
+
+/**
+ * @brief Description of an array of a `npz` archive, read from its npy header
+ */
+struct NpzArrayInfo
+{
+    std::string name;
+    std::vector<size_t> shape;
+    Type dtype;
+    size_t elemSize;
+    bool fortranOrder;
+    bool compressed;    //!< Whether the array is stored with compression
+};
+
+/**
+ * @brief A `npz` archive opened once to load its arrays on demand
+ *
+ * Opening the archive reads the central directory and peeks the npy header
+ * of each array, so that its shape and type are known without loading it.
+ * Loading an array stored without compression then costs a single read.
+ *
+ * The index built on opening is never modified and arrays are read with
+ * pread, each thread decoding with its own inflate state: several threads
+ * can load arrays from the same NpzArchive at the same time.
+ *
+ * @code{.cpp}
+ * cnpy::NpzArchive npz("model.npz");
+ * for(const cnpy::NpzArrayInfo& info: npz.arrays())
+ *     std::cout << info.name << ": " << info.shape.size() << " dimensions\n";
+ * cnpy::NpArray weights = npz.load("weights");
+ * @endcode
+ */
+class NpzArchive
+{
+public:
+    /**
+     * @brief Open a `npz` archive
+     * @param fname Path of the archive
+     * @param checkConsistency Check that the local headers match the central
+     *        directory and the CRC of the loaded arrays; disable it for
+     *        trusted files
+     */
+    explicit NpzArchive(const std::string& fname, const bool checkConsistency=true);
+    ~NpzArchive();
+
+    NpzArchive(const NpzArchive&) = delete;
+    NpzArchive& operator=(const NpzArchive&) = delete;
+
+    /**
+     * @brief The arrays of the archive, in the order of the central directory
+     */
+    const std::vector<NpzArrayInfo>& arrays() const;
+
+    bool contains(const std::string& name) const;
+
+    /**
+     * @brief Description of the array `name`
+     * @throws std::runtime_error If the archive has no array with that name
+     */
+    const NpzArrayInfo& info(const std::string& name) const;
+
+    /**
+     * @brief Load the array `name`
+     * @throws std::runtime_error If the archive has no array with that name
+     */
+    NpArray load(const std::string& name) const;
+
+    /**
+     * @brief Load all the arrays
+     * @param numThreads Number of threads decoding the arrays, 0 to use one per hardware thread
+     */
+    NpArrayDict loadAll(const unsigned numThreads=1) const;
+
+    /**
+     * @brief Load the rows [first, first+count) of the array `name`, as npz_load_rows()
+     */
+    NpArray loadRows(const std::string& name, const size_t first, const size_t count) const;
+
+private:
+    struct Index;
+
+    std::shared_ptr<const Index> readIndex() const;
+    size_t position(const std::string& name) const;
+    NpArray loadAt(const size_t i) const;
+
+    std::string mFname;
+    int mFd;
+    bool mCheckConsistency;
+    std::shared_ptr<const Index> mIndex;
+};
+
+
+/**
+ * @brief Cache of arrays loaded from `npz` files, bounded by a byte budget
+ *
+ * Arrays are kept by path of the archive and name; the least recently used
+ * ones are evicted when the budget is exceeded. A cached array is dropped
+ * when the device, inode, size or modification time of its file change.
+ * All the methods can be called concurrently.
+ *
+ * @code{.cpp}
+ * cnpy::NpzCache cache(2ul << 30);   // 2 GB
+ * std::shared_ptr<const cnpy::NpArray> w = cache.load("model.npz", "weights");
+ * @endcode
+ */
+class NpzCache
+{
+public:
+    /**
+     * @param budget Maximum number of bytes of array data kept in memory
+     */
+    explicit NpzCache(const size_t budget);
+
+    NpzCache(const NpzCache&) = delete;
+    NpzCache& operator=(const NpzCache&) = delete;
+
+    /**
+     * @brief Load the array `name` of the archive `fname`, from memory if possible
+     *
+     * The returned array stays valid after it is evicted from the cache.
+     * Arrays larger than the budget are loaded but not kept.
+     */
+    std::shared_ptr<const NpArray> load(const std::string& fname, const std::string& name);
+
+    /**
+     * @brief Drop all the cached arrays
+     */
+    void clear();
+
+    /**
+     * @brief Bytes of array data currently kept in memory
+     */
+    size_t bytes() const;
+
+    size_t budget() const { return mBudget; }
+
+private:
+    struct FileId
+    {
+        uint64_t dev;
+        uint64_t ino;
+        uint64_t size;
+        int64_t mtimeSec;
+        int64_t mtimeNsec;
+
+        bool operator==(const FileId& other) const
+        {
+            return dev==other.dev && ino==other.ino && size==other.size &&
+                   mtimeSec==other.mtimeSec && mtimeNsec==other.mtimeNsec;
+        }
+    };
+
+    struct Item
+    {
+        std::pair<std::string, std::string> key;    //!< Path of the archive and array name
+        FileId file;
+        std::shared_ptr<const NpArray> array;
+    };
+    typedef std::list<Item> ItemList;
+
+    static FileId identify(const std::string& fname);
+    void erase(const ItemList::iterator it);
+
+    const size_t mBudget;
+    mutable std::mutex mMutex;
+    size_t mBytes;
+    ItemList mItems;    //!< Most recently used first
+    std::map<std::pair<std::string, std::string>, ItemList::iterator> mLookup;
+};
+
+/**
+ * @brief Load a hyperslab of a `npy` file
+ * @param fname Path of the `npy` file
+ * @param slices One Slice per axis; missing trailing slices select the whole axis
+ * @return A compact NpArray with the selected elements, in the order of the file
+ *
+ * Only the byte runs covering the selection are read from the file, so the
+ * I/O scales with the size of the selection instead of the size of the
+ * array. Runs are computed from the shape and order of the header: axes
+ * read whole at the end of the storage order become part of each run.
+ */
+NpArray npy_load_slice(const std::string& fname, const std::vector<Slice>& slices);
+
+/**
+ * @brief Load every `step`-th row of a `npy` file
+ * @param fname Path of the `npy` file
+ * @param step Distance between two loaded rows along the first axis
+ * @param first Index of the first loaded row
+ * @return A NpArray with rows `first`, `first+step`, `first+2*step`...
+ *
+ * Rows close enough that reading the gap between them is cheaper than a
+ * seek are coalesced in vectored reads that drop the gaps in a scratch
+ * buffer, rows far apart are read individually: previewing a huge file
+ * reads about the size of the preview.
+ */
+NpArray npy_load_strided(const std::string& fname, const size_t step, const size_t first=0);
+
+/**
+ * @brief Load a subset of the columns of a 2-dimensional `npy` file
+ * @param fname Path of the `npy` file
+ * @param columns Indices of the columns, in the order they appear in the result
+ * @return A NpArray of shape (rows, columns.size()), in the order of the file
+ *
+ * The I/O plan depends on the order of the file: in fortran order each
+ * column is contiguous and runs of consecutive columns are read with one
+ * positional read each; in C order the span of each row that contains the
+ * columns is read with large sequential reads and the columns are gathered
+ * from it.
+ */
+NpArray npy_load_columns(const std::string& fname, const std::vector<size_t>& columns);
+
+/**
+ * @brief Load a range of rows of a `npy` file
+ * @param fname Path of the `npy` file
+ * @param first Index of the first row along the first axis
+ * @param count Number of rows, clamped to the end of the array
+ * @return A NpArray with the `count` rows
+ *
+ * For C order arrays the rows are a single contiguous range of the file,
+ * read with one positional read after the header.
+ */
+NpArray npy_load_rows(const std::string& fname, const size_t first, const size_t count);
+
+/**
+ * @brief Load a range of rows of an array in a `npz` file
+ * @param fname Path of the `npz` file
+ * @param varname Name of the array
+ * @param first Index of the first row along the first axis
+ * @param count Number of rows, clamped to the end of the array
+ * @return A NpArray with the `count` rows
+ *
+ * Rows of arrays stored without compression are read in place; compressed
+ * arrays are decoded up to the last requested row.
+ */
+NpArray npz_load_rows(const std::string& fname, const std::string& varname,
+                      const size_t first, const size_t count);
+
+/**
+ * @brief Sequential reader of a `npy` file in blocks of rows
+ *
+ * Only one block is read at a time, so arrays larger than the memory can be
+ * processed with a bounded memory footprint.
+ *
+ * @code{.cpp}
+ * cnpy::NpyRowReader reader("huge.npy", 4096);
+ * cnpy::NpArray block;
+ * while(reader.next(block))
+ *     process(block); // block.shape(0) rows, 4096 except for the last block
+ * @endcode
+ */
+class NpyRowReader
+{
+public:
+    /**
+     * @brief Open a `npy` file and read its header
+     * @param fname Path of the `npy` file
+     * @param blockRows Number of rows of each block
+     */
+    NpyRowReader(const std::string& fname, const size_t blockRows);
+    ~NpyRowReader();
+
+    NpyRowReader(const NpyRowReader&) = delete;
+    NpyRowReader& operator=(const NpyRowReader&) = delete;
+
+    /**
+     * @brief Read the next block of rows
+     * @param block Receives the rows
+     * @return false if all the rows have already been read
+     */
+    bool next(NpArray& block);
+
+    /**
+     * @brief Shape of the whole array
+     */
+    const std::vector<size_t>& shape() const { return mShape; }
+
+    /**
+     * @brief Index of the first row returned by the next call to next()
+     */
+    size_t position() const { return mNextRow; }
+
+    /**
+     * @brief Restart from the row `row`
+     */
+    void seek(const size_t row) { mNextRow = row; }
+
+private:
+    std::string mFname;
+    int mFd;
+    uint64_t mDataOffset;
+    std::vector<size_t> mShape;
+    size_t mElemSize;
+    Type mDtype;
+    bool mIsFortranOrder;
+    size_t mBlockRows;
+    size_t mNextRow;
+};
+
+/**
+ * @brief Load a `npy` file without copying its data
+ * @param fname Path of the `npy` file
+ * @param mode Access mode of the mapping
+ * @return A NpArray whose data points into a mapping of the file
+ *
+ * Only the header is parsed: the pages of the data are read by the
+ * operating system on first access and are shared with every other process
+ * that maps the same file. With MapMode::ReadWrite a write to the array
+ * only dirties the touched pages; call NpArray::flush() to push them to
+ * the file.
+ */
+NpArray npy_mmap(const std::string& fname, const MapMode mode=MapMode::ReadOnly);
+
+/**
+ * @brief Load all the arrays of a `npz` file without copying the stored ones
+ * @param fname Path of the `npz` file
+ * @param mode Access mode of the mapping, MapMode::ReadWrite is not allowed
+ * @return The dictionary of the arrays in the archive
+ *
+ * The archive is mapped once: arrays stored without compression are views
+ * on the mapping, located with the central directory and the local file
+ * headers. Compressed arrays are decoded in memory as npz_load() does.
+ */
+NpArrayDict npz_mmap(const std::string& fname, const MapMode mode=MapMode::ReadOnly);
+
+/**
+ * @brief Load an array of a `npz` file without copying it if it is stored
+ * @param fname Path of the `npz` file
+ * @param varname Name of the array
+ * @param mode Access mode of the mapping, MapMode::ReadWrite is not allowed
+ * @return The array `varname`
+ */
+NpArray npz_mmap(const std::string& fname, const std::string& varname, const MapMode mode=MapMode::ReadOnly);
+
+/**
+ * @brief Save an array to a `npy` file
+ * @param fname Path of the `npy` file
+ * @param data Data of the array
+ * @param dtype Type of each element
+ * @param elemSize Size in bytes of each element
+ * @param shape Shape of the array
+ * @param mode 'w' to overwrite the file, 'a' to append along the first dimension
+ * @param alignment The header is padded so that the data starts at a multiple
+ *        of `alignment` bytes: use e.g. 64 for aligned SIMD loads on mapped
+ *        arrays or the page size for O_DIRECT reads. At most 4096, larger
+ *        headers are rejected by numpy.
+ */
 void npy_save_data(const std::string& fname,
                    const unsigned char* data, const Type dtype,
                    const size_t elemSize, const std::vector<size_t>& shape,
-                   const char mode='w');
+                   const char mode='w', const size_t alignment=16);
+/**
+ * @brief Streaming writer of a `npy` file, growing along the first axis
+ *
+ * The file stays open between appends: rows are collected in a buffer and
+ * written with a single write when the buffer is full, and only the shape
+ * field of the header is rewritten on flush() and close(). The header is
+ * created with room for any number of rows, so it never has to move.
+ *
+ * @code{.cpp}
+ * cnpy::NpyWriter writer("log.npy", cnpy::Type::Float, sizeof(float), {3});
+ * for(...)
+ *     writer.append(samples, numRows); // samples holds numRows*3 floats
+ * writer.close();
+ * @endcode
+ */
+class NpyWriter
+{
+public:
+    /**
+     * @brief Open a `npy` file for writing
+     * @param fname Path of the `npy` file
+     * @param dtype Type of each element
+     * @param elemSize Size in bytes of each element
+     * @param rowShape Shape of each row, that is the shape without the first dimension
+     * @param mode 'w' to create a new file, 'a' to append to an existing file with the same dtype and row shape
+     * @param bufferSize Size in bytes of the write buffer
+     * @param alignment Alignment of the data of new files, see npy_save_data()
+     */
+    NpyWriter(const std::string& fname, const Type dtype, const size_t elemSize,
+              const std::vector<size_t>& rowShape, const char mode='w',
+              const size_t bufferSize=1<<20, const size_t alignment=16);
+
+    /**
+     * @brief Close the file, errors are ignored: call close() to handle them
+     */
+    ~NpyWriter();
+
+    NpyWriter(const NpyWriter&) = delete;
+    NpyWriter& operator=(const NpyWriter&) = delete;
+
+    /**
+     * @brief Append rows to the array
+     * @param data The data of `rows` rows
+     * @param rows Number of rows
+     */
+    void append(const unsigned char* data, const size_t rows);
+
+    template<typename _Tp> void append(const _Tp* data, const size_t rows)
+    {
+        append(reinterpret_cast<const unsigned char*>(data), rows);
+    }
+
+    /**
+     * @brief Write the buffered rows and update the shape in the header
+     */
+    void flush();
+
+    /**
+     * @brief Flush and close the file
+     */
+    void close();
+
+    /**
+     * @brief Number of rows written so far, including the buffered ones
+     */
+    size_t rows() const { return mShape[0]; }
+
+private:
+    size_t reservedHeaderSize() const;
+    void writeBuffer();
+    void writeHeader();
+
+    std::string mFname;
+    int mFd;
+    Type mDtype;
+    size_t mElemSize;
+    std::vector<size_t> mShape;
+    size_t mRowBytes;
+    size_t mAlignment;
+    uint64_t mHeaderSize;
+    uint64_t mDataEnd;
+    size_t mBufferSize;
+    std::vector<unsigned char> mBuffer;
+};
+
 void npz_save_data(const std::string& zipname, const std::string& name,
                    const unsigned char* data, const Type dtype,
                    const size_t elemSize, const std::vector<size_t>& shape,
-                   const char mode='w');
+                   const char mode='w', const NpzSaveOptions& options=NpzSaveOptions());
+
+
+/**
+ * @brief Writer of a `npz` archive that stays open while arrays are added
+ *
+ * Each array is streamed to the file once, right after the previous one,
+ * and the central directory is written by close(): saving N arrays costs
+ * a single sequential write of the archive and a single central directory.
+ *
+ * @code{.cpp}
+ * cnpy::NpzWriter npz("checkpoint.npz");
+ * npz.add("weights", weights, {1024, 1024});
+ * npz.add(otherArrays); // a whole NpArrayDict
+ * npz.close();
+ * @endcode
+ */
+class NpzWriter
+{
+public:
+    /**
+     * @brief Open a `npz` archive for writing
+     *
+     * In append mode the central directory of the existing archive is read
+     * and new arrays are written where it started, so the cost of adding an
+     * array does not depend on the size of the archive.
+     *
+     * @param zipname Path of the archive
+     * @param mode 'w' to create a new archive, overwriting an existing file,
+     *             or 'a' to add arrays to an existing archive (created if missing)
+     * @param options Options used for the arrays added without explicit options
+     */
+    NpzWriter(const std::string& zipname, const char mode='w', const NpzSaveOptions& options=NpzSaveOptions());
+
+    /**
+     * @brief Close the archive, errors are ignored: call close() to handle them
+     */
+    ~NpzWriter();
+
+    NpzWriter(const NpzWriter&) = delete;
+    NpzWriter& operator=(const NpzWriter&) = delete;
+
+    /**
+     * @brief Add an array to the archive
+     *
+     * If it throws, nothing is added and an existing array with the same
+     * name is kept: the archive closed afterwards is the one from before.
+     *
+     * @param name Name of the array, an existing array with the same name is replaced
+     */
+    void add(const std::string& name,
+             const unsigned char* data, const Type dtype,
+             const size_t elemSize, const std::vector<size_t>& shape,
+             const NpzSaveOptions& options);
+
+    void add(const std::string& name,
+             const unsigned char* data, const Type dtype,
+             const size_t elemSize, const std::vector<size_t>& shape)
+    {
+        add(name, data, dtype, elemSize, shape, mOptions);
+    }
+
+    template<typename _Tp> void add(const std::string& name, const _Tp* data,
+                                    const std::vector<size_t>& shape)
+    {
+        add(name, reinterpret_cast<const unsigned char*>(data), type<_Tp>(), sizeof(_Tp), shape, mOptions);
+    }
+
+    template<typename _Tp> void add(const std::string& name, const _Tp* data,
+                                    const std::vector<size_t>& shape, const NpzSaveOptions& options)
+    {
+        add(name, reinterpret_cast<const unsigned char*>(data), type<_Tp>(), sizeof(_Tp), shape, options);
+    }
+
+    /**
+     * @brief Add a NpArray, keeping its order
+     */
+    void add(const std::string& name, const NpArray& array);
+
+    /**
+     * @brief Add all the arrays of a dictionary
+     */
+    void add(const NpArrayDict& arrays);
+
+    /**
+     * @brief Remove an array from the archive
+     *
+     * Only the central directory changes: the bytes of the array stay in the
+     * file until compact() reclaims them.
+     * @return false if the archive has no array with that name
+     */
+    bool remove(const std::string& name);
+
+    /**
+     * @brief Reclaim the bytes of removed and replaced arrays
+     *
+     * The arrays are moved towards the beginning of the file in one streaming
+     * pass, keeping their alignment, and the file is truncated by close().
+     * The archive is not readable if the process stops while compacting.
+     *
+     * @param threshold Compact only if the dead bytes are more than this
+     *        fraction of the archive
+     * @return true if the archive has been compacted
+     */
+    bool compact(const double threshold=0.0);
+
+    /**
+     * @brief Write the central directory and close the file
+     */
+    void close();
+
+private:
+    void addArray(const std::string& name,
+                  const unsigned char* data, const Type dtype,
+                  const size_t elemSize, const std::vector<size_t>& shape,
+                  const bool fortranOrder, const NpzSaveOptions& options);
+
+    std::string mZipname;
+    int mFd;
+    NpzSaveOptions mOptions;
+    std::unique_ptr<ZipWriter> mZip;
+};
 
 
 template<typename _Tp> void npy_save(std::string fname,
                                      const _Tp* data, const std::vector<size_t>& shape,
-                                     const char mode='w')
+                                     const char mode='w', const size_t alignment=16)
 {
     npy_save_data(fname, reinterpret_cast<const unsigned char*>(data),
-                  type<_Tp>(), sizeof(_Tp), shape, mode);
+                  type<_Tp>(), sizeof(_Tp), shape, mode, alignment);
 }
 
 template<typename _Tp> void npz_save(const std::string& zipname, const std::string& name,
                                    const _Tp* data, const std::vector<size_t>& shape,
-                                   const char mode='w')
+                                   const char mode='w', const NpzSaveOptions& options=NpzSaveOptions())
 {
     npz_save_data(zipname, name, reinterpret_cast<const unsigned char*>(data),
-                  type<_Tp>(), sizeof(_Tp), shape, mode);
+                  type<_Tp>(), sizeof(_Tp), shape, mode, options);
 }
 
+/**
+ * @brief Remove an array from a `npz` archive
+ *
+ * Only the central directory is rewritten, use NpzWriter::compact() to
+ * reclaim the space of the array.
+ * @return false if the archive has no array with that name
+ */
+bool npz_remove(const std::string& zipname, const std::string& name);
+
 }
 
 #endif
@@ -0,0 +1,27 @@
+#ifndef CNPY_TESTS_CHECK_H_
+#define CNPY_TESTS_CHECK_H_
+
+#include <stdexcept>
+#include <string>
+
+/**
+ * @brief Throw with the location and the text of `cond` unless it holds
+ */
+#define CHECK(cond) \
+    do { \
+        if(!(cond)) \
+            throw std::runtime_error(std::string(__FILE__)+":"+std::to_string(__LINE__)+": "+#cond); \
+    } while(0)
+
+/**
+ * @brief Throw with the location and the text of `expr` unless it throws std::runtime_error
+ */
+#define CHECK_THROWS(expr) \
+    do { \
+        bool thrown = false; \
+        try { expr; } catch(std::runtime_error&) { thrown = true; } \
+        if(!thrown) \
+            throw std::runtime_error(std::string(__FILE__)+":"+std::to_string(__LINE__)+": no exception from "+#expr); \
+    } while(0)
+
+#endif
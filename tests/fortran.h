@@ -0,0 +1,39 @@
+#ifndef CNPY_TESTS_FORTRAN_H_
+#define CNPY_TESTS_FORTRAN_H_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "check.h"
+
+/**
+ * @brief Write a Fortran order `npy` file by hand, npy_save only writes C order
+ * @param fname Path of the file
+ * @param descr numpy type string of the elements, as `<i4`
+ * @param shape Shape of the array
+ * @param data Elements in Fortran order
+ */
+template<typename T> static void saveFortran(const std::string& fname, const std::string& descr,
+                                             const std::vector<size_t>& shape, const std::vector<T>& data)
+{
+    std::string dims;
+    for(const size_t n: shape)
+        dims += (dims.empty() ? "" : ", ") + std::to_string(n);
+    if(shape.size() == 1)
+        dims += ",";
+    std::string dict = "{'descr': '"+descr+"', 'fortran_order': True, 'shape': ("+dims+"), }";
+    while((10 + dict.size() + 1) % 16 != 0)
+        dict += ' ';
+    dict += '\n';
+    std::FILE* fp = std::fopen(fname.c_str(), "wb");
+    CHECK(fp != nullptr);
+    const unsigned char preamble[10] = {0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0,
+                                        (unsigned char)(dict.size() & 0xFF), (unsigned char)(dict.size() >> 8)};
+    std::fwrite(preamble, 1, sizeof(preamble), fp);
+    std::fwrite(dict.data(), 1, dict.size(), fp);
+    std::fwrite(data.data(), sizeof(T), data.size(), fp);
+    std::fclose(fp);
+}
+
+#endif
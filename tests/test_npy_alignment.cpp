@@ -0,0 +1,82 @@
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cnpy.h"
+#include "check.h"
+
+const size_t N = 1000;
+
+//offset of the data in a npy file, from the version and size fields of the preamble
+static size_t dataOffset(const std::string& fname, int& version)
+{
+    unsigned char preamble[12] = {0};
+    std::ifstream file(fname, std::ios::binary);
+    file.read(reinterpret_cast<char*>(preamble), sizeof(preamble));
+    version = preamble[6];
+    if(version == 1)
+        return 10 + (preamble[8] | preamble[9]<<8);
+    return 12 + (preamble[8] | preamble[9]<<8 | preamble[10]<<16 | uint32_t(preamble[11])<<24);
+}
+
+static void checkAligned(const std::string& fname, const size_t alignment, const size_t rows)
+{
+    int version = 0;
+    const size_t offset = dataOffset(fname, version);
+    CHECK(version == 1);
+    CHECK(offset % alignment == 0);
+    CHECK(std::ifstream(fname, std::ios::binary | std::ios::ate).tellg() == std::streamoff(offset + rows*sizeof(double)));
+
+    //the mapping is page aligned, so is the data pointer
+    cnpy::NpArray mapped = cnpy::npy_mmap(fname);
+    CHECK(reinterpret_cast<uintptr_t>(mapped.data()) % alignment == 0);
+    CHECK(mapped.shape(0) == rows);
+}
+
+int main()
+{
+    std::vector<double> data(N);
+    for(size_t i = 0; i < N; i++)
+        data[i] = i * 0.5;
+
+    for(const size_t alignment: {1, 16, 64, 4096})
+    {
+        const std::string fname = "alignment_" + std::to_string(alignment) + ".npy";
+        cnpy::npy_save(fname, data.data(), {N}, 'w', alignment);
+        checkAligned(fname, alignment, N);
+
+        //appending keeps the header size and so the alignment
+        cnpy::npy_save(fname, data.data(), {N}, 'a', alignment);
+        checkAligned(fname, alignment, 2*N);
+        cnpy::NpArray loaded = cnpy::npy_load(fname);
+        CHECK(std::memcmp(loaded.data() + N*sizeof(double), data.data(), N*sizeof(double)) == 0);
+    }
+
+    {
+        cnpy::NpyWriter writer("alignment_writer.npy", cnpy::Type::Double, sizeof(double), {}, 'w', 1<<20, 4096);
+        writer.append(data.data(), N);
+        writer.close();
+    }
+    checkAligned("alignment_writer.npy", 4096, N);
+
+    //numpy would refuse the header of larger alignments
+    CHECK_THROWS(cnpy::npy_save("alignment_large.npy", data.data(), {N}, 'w', 8192));
+    CHECK_THROWS(cnpy::npy_save("alignment_large.npy", data.data(), {N}, 'w', 0));
+    CHECK_THROWS(cnpy::NpyWriter("alignment_large.npy", cnpy::Type::Double, sizeof(double), {}, 'w', 1<<20, 16384));
+
+    //a dict longer than the 16 bits size field of version 1.0 switches to version 2.0
+    const std::vector<size_t> manyDims(25000, 1);
+    cnpy::npy_save("alignment_v2.npy", data.data(), manyDims, 'w', 64);
+    int version = 0;
+    CHECK(dataOffset("alignment_v2.npy", version) % 64 == 0);
+    CHECK(version == 2);
+    cnpy::NpArray loaded = cnpy::npy_load("alignment_v2.npy");
+    CHECK(loaded.nDims() == manyDims.size() && loaded.numElements() == 1);
+    CHECK(reinterpret_cast<const double*>(loaded.data())[0] == data[0]);
+
+    std::cout << "npy alignment test passed" << std::endl;
+    return 0;
+}
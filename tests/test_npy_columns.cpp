@@ -0,0 +1,82 @@
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cnpy.h"
+#include "check.h"
+#include "fortran.h"
+
+const size_t ROWS = 50;
+const size_t COLS = 12;
+
+static int64_t value(const size_t r, const size_t c)
+{
+    return int64_t(r*1000 + c);
+}
+
+//values of the array in the order of a Fortran file
+static std::vector<int64_t> fortranData()
+{
+    std::vector<int64_t> data;
+    for(size_t c = 0; c < COLS; c++)
+        for(size_t r = 0; r < ROWS; r++)
+            data.push_back(value(r, c));
+    return data;
+}
+
+static void checkColumns(const cnpy::NpArray& arr, const std::vector<size_t>& columns, const bool fortran)
+{
+    CHECK(arr.nDims() == 2 && arr.shape(0) == ROWS && arr.shape(1) == columns.size());
+    CHECK(arr.isFortranOrder() == fortran);
+    const int64_t* data = reinterpret_cast<const int64_t*>(arr.data());
+    for(size_t r = 0; r < ROWS; r++)
+        for(size_t j = 0; j < columns.size(); j++)
+            CHECK(data[fortran ? j*ROWS + r : r*columns.size() + j] == value(r, columns[j]));
+}
+
+int main()
+{
+    std::vector<int64_t> data;
+    for(size_t r = 0; r < ROWS; r++)
+        for(size_t c = 0; c < COLS; c++)
+            data.push_back(value(r, c));
+    cnpy::npy_save("columns_c.npy", data.data(), {ROWS, COLS});
+    saveFortran("columns_f.npy", "<i8", {ROWS, COLS}, fortranData());
+
+    const std::vector<std::vector<size_t>> cases = {
+        {0},
+        {COLS-1},
+        {3, 4, 5},          //one run
+        {7, 2, 3, 11, 0},   //unordered, with a run
+        {5, 5},             //repeated
+        {},
+    };
+    for(const std::vector<size_t>& columns: cases)
+    {
+        checkColumns(cnpy::npy_load_columns("columns_c.npy", columns), columns, false);
+        checkColumns(cnpy::npy_load_columns("columns_f.npy", columns), columns, true);
+    }
+
+    //rows so wide that each span of the columns is read on its own, over several read chunks
+    const size_t wideRows = 10;
+    const size_t wideCols = 600000;
+    std::vector<int32_t> wide(wideRows*wideCols);
+    for(size_t i = 0; i < wide.size(); i++)
+        wide[i] = int32_t(i);
+    cnpy::npy_save("columns_wide.npy", wide.data(), {wideRows, wideCols});
+    const std::vector<size_t> scattered = {10, 500000, 3, 250000, 499999};
+    cnpy::NpArray arr = cnpy::npy_load_columns("columns_wide.npy", scattered);
+    CHECK(arr.shape(0) == wideRows && arr.shape(1) == scattered.size() && !arr.isFortranOrder());
+    const int32_t* loaded = reinterpret_cast<const int32_t*>(arr.data());
+    for(size_t r = 0; r < wideRows; r++)
+        for(size_t j = 0; j < scattered.size(); j++)
+            CHECK(loaded[r*scattered.size() + j] == int32_t(r*wideCols + scattered[j]));
+
+    CHECK_THROWS(cnpy::npy_load_columns("columns_c.npy", {COLS}));
+    cnpy::npy_save("columns_3d.npy", data.data(), {2, ROWS/2, COLS});
+    CHECK_THROWS(cnpy::npy_load_columns("columns_3d.npy", {0}));
+
+    std::cout << "npy columns test passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cnpy.h"
+#include "check.h"
+#include "fortran.h"
+
+const size_t ROWS = 300;
+const size_t COLS = 7;
+
+static void checkSame(const cnpy::NpArray& mapped, const cnpy::NpArray& loaded)
+{
+    CHECK(mapped.isMapped() && !loaded.isMapped());
+    CHECK(mapped.nDims() == loaded.nDims());
+    for(size_t i = 0; i < mapped.nDims(); i++)
+        CHECK(mapped.shape(i) == loaded.shape(i));
+    CHECK(mapped.dtype() == loaded.dtype());
+    CHECK(mapped.isFortranOrder() == loaded.isFortranOrder());
+    CHECK(mapped.size() == loaded.size());
+    CHECK(std::memcmp(mapped.data(), loaded.data(), loaded.size()) == 0);
+}
+
+//the first `size` bytes of `src` in `dst`
+static void truncateCopy(const std::string& src, const std::string& dst, const size_t size)
+{
+    std::ifstream in(src, std::ios::binary);
+    std::vector<char> bytes(size);
+    in.read(bytes.data(), size);
+    std::ofstream out(dst, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), in.gcount());
+}
+
+static double* values(cnpy::NpArray& arr)
+{
+    return reinterpret_cast<double*>(arr.data());
+}
+
+//writes through a mapping reach the file only in MapMode::ReadWrite
+static void checkWrites(const std::vector<double>& data)
+{
+    cnpy::npy_save("mmap_rw.npy", data.data(), {ROWS, COLS});
+    {
+        cnpy::NpArray rw = cnpy::npy_mmap("mmap_rw.npy", cnpy::MapMode::ReadWrite);
+        values(rw)[0] = -1.0;
+        values(rw)[ROWS*COLS-1] = -2.0;
+        rw.flush();
+        cnpy::NpArray loaded = cnpy::npy_load("mmap_rw.npy");
+        CHECK(values(loaded)[0] == -1.0 && values(loaded)[ROWS*COLS-1] == -2.0);
+
+        values(rw)[COLS] = -3.0;
+        rw.flush(true);
+    }
+    cnpy::NpArray loaded = cnpy::npy_load("mmap_rw.npy");
+    CHECK(values(loaded)[0] == -1.0 && values(loaded)[COLS] == -3.0 && values(loaded)[1] == data[1]);
+
+    cnpy::npy_save("mmap_cow.npy", data.data(), {ROWS, COLS});
+    {
+        cnpy::NpArray cow = cnpy::npy_mmap("mmap_cow.npy", cnpy::MapMode::CopyOnWrite);
+        values(cow)[0] = -1.0;
+        cow.flush();
+        CHECK(values(cow)[0] == -1.0);
+        //a second mapping of the file does not see the private copy
+        cnpy::NpArray other = cnpy::npy_mmap("mmap_cow.npy");
+        CHECK(values(other)[0] == data[0]);
+    }
+    loaded = cnpy::npy_load("mmap_cow.npy");
+    CHECK(std::memcmp(loaded.data(), data.data(), data.size()*sizeof(double)) == 0);
+
+    //flushing an array that does not write to a file does nothing
+    cnpy::NpArray ro = cnpy::npy_mmap("mmap_cow.npy");
+    ro.flush();
+    values(loaded)[0] = -1.0;
+    loaded.flush();
+    CHECK(values(loaded)[0] == -1.0);
+    cnpy::NpArray().flush();
+    loaded = cnpy::npy_load("mmap_cow.npy");
+    CHECK(values(loaded)[0] == data[0]);
+}
+
+int main()
+{
+    std::vector<double> data(ROWS*COLS);
+    for(size_t i = 0; i < data.size(); i++)
+        data[i] = i * 0.25;
+    cnpy::npy_save("mmap_c.npy", data.data(), {ROWS, COLS});
+    saveFortran("mmap_f.npy", "<f8", {ROWS, COLS}, data);
+
+    //a read-only map holds the same array as npy_load
+    checkSame(cnpy::npy_mmap("mmap_c.npy"), cnpy::npy_load("mmap_c.npy"));
+    checkSame(cnpy::npy_mmap("mmap_f.npy"), cnpy::npy_load("mmap_f.npy"));
+    checkSame(cnpy::npy_mmap("mmap_c.npy", cnpy::MapMode::CopyOnWrite), cnpy::npy_load("mmap_c.npy"));
+
+    checkWrites(data);
+
+    //the data of a mapped array belongs to the mapping
+    cnpy::NpArray mapped = cnpy::npy_mmap("mmap_c.npy");
+    CHECK(mapped.hasDataOwnership());
+    CHECK_THROWS(mapped.revokeDataOwnership());
+    CHECK(mapped.hasDataOwnership());
+
+    //the mapping stays valid after the file is gone, until the last array that views it
+    cnpy::npy_save("mmap_tmp.npy", data.data(), {ROWS, COLS});
+    cnpy::NpArray moved;
+    {
+        cnpy::NpArray first = cnpy::npy_mmap("mmap_tmp.npy");
+        CHECK(std::remove("mmap_tmp.npy") == 0);
+        moved = std::move(first);
+    }
+    CHECK(moved.isMapped());
+    CHECK(std::memcmp(moved.data(), data.data(), data.size()*sizeof(double)) == 0);
+
+    //the stored arrays of an archive outlive the dictionary that mapped them
+    cnpy::npz_save("mmap.npz", "a", data.data(), {ROWS, COLS}, 'w');
+    cnpy::npz_save("mmap.npz", "b", data.data(), {COLS}, 'a');
+    cnpy::NpArray fromNpz;
+    {
+        cnpy::NpArrayDict dict = cnpy::npz_mmap("mmap.npz");
+        fromNpz = std::move(dict.at("a"));
+    }
+    CHECK(fromNpz.isMapped() && fromNpz.shape(0) == ROWS && fromNpz.shape(1) == COLS);
+    CHECK(std::memcmp(fromNpz.data(), data.data(), data.size()*sizeof(double)) == 0);
+    checkSame(cnpy::npz_mmap("mmap.npz", "b"), cnpy::npz_load("mmap.npz", "b"));
+
+    //truncated data, truncated header and a file that is not npy
+    const size_t fileSize = std::ifstream("mmap_c.npy", std::ios::binary | std::ios::ate).tellg();
+    truncateCopy("mmap_c.npy", "mmap_bad.npy", fileSize - 1);
+    CHECK_THROWS(cnpy::npy_mmap("mmap_bad.npy"));
+    truncateCopy("mmap_c.npy", "mmap_bad.npy", 40);
+    CHECK_THROWS(cnpy::npy_mmap("mmap_bad.npy"));
+    truncateCopy("mmap_c.npy", "mmap_bad.npy", 0);
+    CHECK_THROWS(cnpy::npy_mmap("mmap_bad.npy"));
+    {
+        std::ofstream out("mmap_bad.npy", std::ios::binary | std::ios::trunc);
+        out << "this is not a numpy file, but it is long enough to hold a header";
+    }
+    CHECK_THROWS(cnpy::npy_mmap("mmap_bad.npy"));
+    CHECK_THROWS(cnpy::npy_mmap("mmap_missing.npy"));
+
+    std::cout << "npy mmap test passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include "cnpy.h"
+#include "check.h"
+
+const size_t ROWS = 20;
+const size_t COLS = 3;
+
+static void checkRows(const cnpy::NpArray& arr, const std::vector<float>& data, const size_t first, const size_t count)
+{
+    CHECK(arr.nDims() == 2);
+    CHECK(arr.shape(0) == count && arr.shape(1) == COLS);
+    CHECK(arr.dtype() == cnpy::Type::Float);
+    CHECK(std::memcmp(arr.data(), &data[first*COLS], count*COLS*sizeof(float)) == 0);
+}
+
+int main()
+{
+    std::vector<float> data(ROWS*COLS);
+    for(size_t i = 0; i < data.size(); i++)
+        data[i] = 0.5f*i;
+    cnpy::npy_save("rows.npy", data.data(), {ROWS, COLS});
+    cnpy::npz_save("rows.npz", "other", data.data(), {2, COLS});
+    cnpy::npz_save("rows.npz", "rows", data.data(), {ROWS, COLS}, 'a');
+
+    checkRows(cnpy::npy_load_rows("rows.npy", 0, ROWS), data, 0, ROWS);
+    checkRows(cnpy::npy_load_rows("rows.npy", 5, 4), data, 5, 4);
+    checkRows(cnpy::npy_load_rows("rows.npy", 18, 10), data, 18, 2);   //clamped
+    checkRows(cnpy::npy_load_rows("rows.npy", 30, 1), data, 0, 0);     //past the end
+
+    checkRows(cnpy::npz_load_rows("rows.npz", "rows", 5, 4), data, 5, 4);
+    checkRows(cnpy::npz_load_rows("rows.npz", "rows", 19, 3), data, 19, 1);
+    CHECK_THROWS(cnpy::npz_load_rows("rows.npz", "missing", 0, 1));
+
+    //blocks of 7 rows: 7, 7 and the 6 left
+    cnpy::NpyRowReader reader("rows.npy", 7);
+    CHECK(reader.shape().size() == 2 && reader.shape()[0] == ROWS);
+    cnpy::NpArray block;
+    size_t row = 0;
+    while(reader.next(block))
+    {
+        const size_t count = std::min<size_t>(7, ROWS-row);
+        checkRows(block, data, row, count);
+        row += count;
+        CHECK(reader.position() == row);
+    }
+    CHECK(row == ROWS);
+    CHECK(!reader.next(block));
+
+    reader.seek(16);
+    CHECK(reader.next(block));
+    checkRows(block, data, 16, 4);
+    CHECK(!reader.next(block));
+
+    //blocks larger than any count of rows end at the last row
+    cnpy::NpyRowReader whole("rows.npy", std::numeric_limits<size_t>::max());
+    whole.seek(5);
+    CHECK(whole.next(block));
+    checkRows(block, data, 5, ROWS-5);
+    CHECK(whole.position() == ROWS);
+    CHECK(!whole.next(block));
+
+    std::cout << "npy rows test passed" << std::endl;
+    return 0;
+}
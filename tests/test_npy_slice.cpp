@@ -0,0 +1,88 @@
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cnpy.h"
+#include "check.h"
+#include "fortran.h"
+
+const size_t T = 6;
+const size_t H = 5;
+const size_t W = 4;
+
+static int32_t value(const size_t t, const size_t h, const size_t w)
+{
+    return int32_t(t*100 + h*10 + w);
+}
+
+//values of the array in the order of a Fortran file
+static std::vector<int32_t> fortranData()
+{
+    std::vector<int32_t> data;
+    for(size_t w = 0; w < W; w++)
+        for(size_t h = 0; h < H; h++)
+            for(size_t t = 0; t < T; t++)
+                data.push_back(value(t, h, w));
+    return data;
+}
+
+//compare a loaded slice with the values it should hold, in the order of the file
+static void checkSlice(const cnpy::NpArray& arr, const std::vector<cnpy::Slice>& slices, const bool fortran)
+{
+    const size_t dims[3] = {T, H, W};
+    std::vector<size_t> idx[3];
+    for(size_t a = 0; a < 3; a++)
+    {
+        const cnpy::Slice s = a < slices.size() ? slices[a] : cnpy::Slice();
+        for(size_t i = s.start; i < std::min(s.stop, dims[a]); i += s.step)
+            idx[a].push_back(i);
+        CHECK(arr.shape(a) == idx[a].size());
+    }
+    CHECK(arr.isFortranOrder() == fortran);
+
+    const int32_t* data = reinterpret_cast<const int32_t*>(arr.data());
+    size_t k = 0;
+    if(!fortran)
+    {
+        for(size_t t: idx[0]) for(size_t h: idx[1]) for(size_t w: idx[2])
+            CHECK(data[k++] == value(t, h, w));
+    }
+    else
+    {
+        for(size_t w: idx[2]) for(size_t h: idx[1]) for(size_t t: idx[0])
+            CHECK(data[k++] == value(t, h, w));
+    }
+    CHECK(k*sizeof(int32_t) == arr.size());
+}
+
+int main()
+{
+    std::vector<int32_t> data;
+    for(size_t t = 0; t < T; t++)
+        for(size_t h = 0; h < H; h++)
+            for(size_t w = 0; w < W; w++)
+                data.push_back(value(t, h, w));
+    cnpy::npy_save("slice_c.npy", data.data(), {T, H, W});
+    saveFortran("slice_f.npy", "<i4", {T, H, W}, fortranData());
+
+    const std::vector<std::vector<cnpy::Slice>> cases = {
+        {},                                                 //whole array
+        {cnpy::Slice(2, 3)},                                //one time step
+        {cnpy::Slice(1, 5, 2), cnpy::Slice(1, 4)},          //strided window
+        {cnpy::Slice(), cnpy::Slice(), cnpy::Slice(3, 4)},  //last axis only
+        {cnpy::Slice(0, 100, 5), cnpy::Slice(4), cnpy::Slice(1, 100, 2)},  //clamped stops
+        {cnpy::Slice(3, 3)},                                //empty
+    };
+    for(const std::vector<cnpy::Slice>& slices: cases)
+    {
+        checkSlice(cnpy::npy_load_slice("slice_c.npy", slices), slices, false);
+        checkSlice(cnpy::npy_load_slice("slice_f.npy", slices), slices, true);
+    }
+
+    CHECK_THROWS(cnpy::npy_load_slice("slice_c.npy", {cnpy::Slice(0, 1, 0)}));
+    CHECK_THROWS(cnpy::npy_load_slice("slice_c.npy", {cnpy::Slice(), cnpy::Slice(), cnpy::Slice(), cnpy::Slice()}));
+
+    std::cout << "npy slice test passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "cnpy.h"
+#include "check.h"
+
+static void checkStrided(const std::string& fname, const std::vector<uint16_t>& data,
+                         const size_t rows, const size_t cols, const size_t step, const size_t first)
+{
+    cnpy::NpArray arr = cnpy::npy_load_strided(fname, step, first);
+    const size_t count = first < rows ? (rows - first + step - 1) / step : 0;
+    CHECK(arr.shape(0) == count);
+    const uint16_t* loaded = reinterpret_cast<const uint16_t*>(arr.data());
+    for(size_t i = 0; i < count; i++)
+        CHECK(std::memcmp(loaded + i*cols, &data[(first + i*step)*cols], cols*sizeof(uint16_t)) == 0);
+}
+
+int main()
+{
+    //short rows are coalesced, long rows are read one by one
+    const size_t shapes[2][2] = {{1000, 3}, {40, 50000}};
+    for(const auto& shape: shapes)
+    {
+        const size_t rows = shape[0];
+        const size_t cols = shape[1];
+        std::vector<uint16_t> data(rows*cols);
+        for(size_t i = 0; i < data.size(); i++)
+            data[i] = uint16_t(i * 7);
+        cnpy::npy_save("strided.npy", data.data(), {rows, cols});
+
+        for(size_t step: {1, 2, 3, 10, 1000, 5000})
+            for(size_t first: {size_t(0), size_t(1), rows-1, rows})
+                checkStrided("strided.npy", data, rows, cols, step, first);
+    }
+
+    std::vector<uint16_t> line(100);
+    for(size_t i = 0; i < line.size(); i++)
+        line[i] = uint16_t(i);
+    cnpy::npy_save("strided_1d.npy", line.data(), {line.size()});
+    checkStrided("strided_1d.npy", line, line.size(), 1, 7, 3);
+
+    CHECK_THROWS(cnpy::npy_load_strided("strided.npy", 0));
+
+    std::cout << "npy strided test passed" << std::endl;
+    return 0;
+}
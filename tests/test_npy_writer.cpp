@@ -0,0 +1,78 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "cnpy.h"
+#include "check.h"
+
+const size_t COLS = 3;
+
+static void checkArray(const std::string& fname, const std::vector<int32_t>& data, const size_t rows,
+                       const size_t nDims=2)
+{
+    cnpy::NpArray arr = cnpy::npy_load(fname);
+    CHECK(arr.nDims() == nDims);
+    CHECK(arr.shape(0) == rows && arr.shape(1) == COLS);
+    CHECK(arr.numElements() == rows*COLS);
+    CHECK(arr.dtype() == cnpy::Type::Int32);
+    CHECK(std::memcmp(arr.data(), data.data(), rows*COLS*sizeof(int32_t)) == 0);
+}
+
+static size_t fileSize(const std::string& fname)
+{
+    std::ifstream file(fname, std::ios::binary | std::ios::ate);
+    return size_t(file.tellg());
+}
+
+int main()
+{
+    std::vector<int32_t> data(200000*COLS);
+    for(size_t i = 0; i < data.size(); i++)
+        data[i] = int32_t(i);
+
+    //rows one at a time through a buffer smaller than a few rows, then a batch larger than it
+    {
+        cnpy::NpyWriter writer("writer.npy", cnpy::Type::Int32, sizeof(int32_t), {COLS}, 'w', 64);
+        for(size_t row = 0; row < 1000; row++)
+            writer.append(&data[row*COLS], 1);
+        CHECK(writer.rows() == 1000);
+        writer.flush();
+        checkArray("writer.npy", data, 1000);
+
+        writer.append(&data[1000*COLS], 500);
+        writer.close();
+        CHECK_THROWS(writer.append(&data[0], 1));
+    }
+    checkArray("writer.npy", data, 1500);
+
+    //reopen and continue, the header reserved on creation is kept
+    {
+        cnpy::NpyWriter writer("writer.npy", cnpy::Type::Int32, sizeof(int32_t), {COLS}, 'a');
+        CHECK(writer.rows() == 1500);
+        writer.append(&data[1500*COLS], 500);
+    }
+    checkArray("writer.npy", data, 2000);
+
+    CHECK_THROWS(cnpy::NpyWriter("writer.npy", cnpy::Type::Float, sizeof(float), {COLS}, 'a'));
+    CHECK_THROWS(cnpy::NpyWriter("writer.npy", cnpy::Type::Int32, sizeof(int32_t), {COLS+1}, 'a'));
+
+    //npy_save writes a tight header: the 80 bytes of (9, 3, 1, 1) have 3
+    //spare bytes, so appending has to grow it at 10000 rows without
+    //overwriting the rows already stored
+    cnpy::npy_save("grow.npy", data.data(), {9, COLS, 1, 1});
+    CHECK(fileSize("grow.npy") == 80 + 9*COLS*sizeof(int32_t));
+    size_t rows = 9;
+    const size_t steps[] = {1, 90, 900, 9000, 90000, 100000};
+    for(const size_t step : steps)
+    {
+        cnpy::npy_save("grow.npy", &data[rows*COLS], {step, COLS, 1, 1}, 'a');
+        rows += step;
+        checkArray("grow.npy", data, rows, 4);
+    }
+    CHECK(rows == 200000);
+    CHECK(fileSize("grow.npy") > 80 + rows*COLS*sizeof(int32_t));
+
+    std::cout << "npy writer test passed" << std::endl;
+    return 0;
+}
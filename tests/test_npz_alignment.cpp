@@ -0,0 +1,62 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "cnpy.h"
+#include "check.h"
+
+const size_t N = 1000;
+
+static bool aligned(const unsigned char* p, const size_t alignment)
+{
+    return reinterpret_cast<uintptr_t>(p) % alignment == 0;
+}
+
+int main()
+{
+    std::vector<double> data(N);
+    for(size_t i = 0; i < N; i++)
+        data[i] = rand();
+    std::vector<int16_t> small(7, 3);
+
+    cnpy::NpzSaveOptions align64;
+    align64.alignment = 64;
+    cnpy::NpzSaveOptions align4096;
+    align4096.alignment = 4096;
+
+    cnpy::npz_save("alignment.npz", "a", data.data(), {N}, 'w', align64);
+    cnpy::npz_save("alignment.npz", "b", small.data(), {small.size()}, 'a', align4096);
+    cnpy::npz_save("alignment.npz", "c", data.data(), {0}, 'a');
+
+    //offsets in the file are aligned, so are the pointers into the page aligned mapping
+    cnpy::NpArrayDict mapped = cnpy::npz_mmap("alignment.npz");
+    CHECK(mapped.size() == 3);
+    CHECK(aligned(mapped.at("a").data(), 64));
+    CHECK(aligned(mapped.at("b").data(), 4096));
+
+    //appending keeps the alignment of the entries already there
+    cnpy::npz_save("alignment.npz", "d", data.data(), {N/2}, 'a', align64);
+    mapped = cnpy::npz_mmap("alignment.npz");
+    CHECK(aligned(mapped.at("a").data(), 64));
+    CHECK(aligned(mapped.at("b").data(), 4096));
+    CHECK(aligned(mapped.at("d").data(), 64));
+
+    cnpy::NpArrayDict loaded = cnpy::npz_load("alignment.npz");
+    CHECK(loaded.size() == 4);
+    CHECK(loaded.at("a").shape(0) == N);
+    CHECK(std::memcmp(loaded.at("a").data(), data.data(), N*sizeof(double)) == 0);
+    CHECK(loaded.at("b").dtype() == cnpy::Type::Int16);
+    CHECK(std::memcmp(loaded.at("b").data(), small.data(), small.size()*sizeof(int16_t)) == 0);
+    CHECK(loaded.at("c").nDims() == 1 && loaded.at("c").shape(0) == 0);
+    CHECK(std::memcmp(loaded.at("d").data(), data.data(), N/2*sizeof(double)) == 0);
+
+    cnpy::NpzSaveOptions tooLarge;
+    tooLarge.alignment = 65536;
+    CHECK_THROWS(cnpy::npz_save("alignment.npz", "e", data.data(), {N}, 'a', tooLarge));
+    CHECK(cnpy::npz_load("alignment.npz").size() == 4);
+
+    std::cout << "npz alignment test passed" << std::endl;
+    return 0;
+}
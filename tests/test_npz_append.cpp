@@ -0,0 +1,62 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "cnpy.h"
+#include "check.h"
+#include "zip_bytes.h"
+
+static void checkArray(const cnpy::NpArray& arr, const std::vector<float>& data, const size_t count)
+{
+    CHECK(arr.nDims() == 1 && arr.shape(0) == count);
+    CHECK(std::memcmp(arr.data(), data.data(), count*sizeof(float)) == 0);
+}
+
+int main()
+{
+    std::vector<float> data(100000);
+    for(size_t i = 0; i < data.size(); i++)
+        data[i] = 1.5f*i;
+
+    std::remove("append.npz");
+    cnpy::npz_save("append.npz", "a", data.data(), {1000}, 'a');   //created if missing
+    cnpy::npz_save("append.npz", "b", data.data(), {2000}, 'a');
+
+    //appending keeps every byte before the old central directory and
+    //grows the file by about the size of the new array
+    const std::vector<unsigned char> before = readFile("append.npz");
+    const size_t cdOffset = centralDirectoryOffset(before);
+    cnpy::npz_save("append.npz", "c", data.data(), {100000}, 'a');
+    const std::vector<unsigned char> after = readFile("append.npz");
+    CHECK(after.size() > cdOffset + 100000*sizeof(float));
+    CHECK(after.size() < before.size() + 100000*sizeof(float) + 1024);
+    CHECK(std::equal(before.begin(), before.begin()+cdOffset, after.begin()));
+    CHECK(centralDirectoryOffset(after) > cdOffset);
+
+    //several arrays through one writer, the central directory is written once
+    {
+        cnpy::NpzWriter npz("append.npz", 'a');
+        npz.add("d", data.data(), {10});
+        npz.add("e", data.data(), {20});
+    }
+
+    cnpy::NpArrayDict arrays = cnpy::npz_load("append.npz");
+    CHECK(arrays.size() == 5);
+    checkArray(arrays["a"], data, 1000);
+    checkArray(arrays["b"], data, 2000);
+    checkArray(arrays["c"], data, 100000);
+    checkArray(arrays["d"], data, 10);
+    checkArray(arrays["e"], data, 20);
+
+    //an array that is already there is replaced
+    cnpy::npz_save("append.npz", "b", data.data()+5, {7}, 'a');
+    arrays = cnpy::npz_load("append.npz");
+    CHECK(arrays.size() == 5);
+    CHECK(arrays["b"].shape(0) == 7);
+    CHECK(std::memcmp(arrays["b"].data(), data.data()+5, 7*sizeof(float)) == 0);
+    checkArray(arrays["c"], data, 100000);
+
+    std::cout << "npz append test passed" << std::endl;
+    return 0;
+}
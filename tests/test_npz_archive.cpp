@@ -0,0 +1,155 @@
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cnpy.h"
+#include "check.h"
+#include "zip_bytes.h"
+
+template<typename T> static void checkArray(const cnpy::NpArray& arr, const std::vector<T>& data,
+                                            const std::vector<size_t>& shape, const size_t first=0)
+{
+    CHECK(arr.nDims() == shape.size());
+    for(size_t i = 0; i < shape.size(); i++)
+        CHECK(arr.shape(i) == shape[i]);
+    CHECK(arr.dtype() == cnpy::type<T>());
+    CHECK(std::memcmp(arr.data(), data.data()+first, arr.size()) == 0);
+}
+
+int main()
+{
+    std::vector<float> x(100*4);
+    for(size_t i = 0; i < x.size(); i++)
+        x[i] = 0.5f*i;
+    std::vector<int8_t> y(17);
+    for(size_t i = 0; i < y.size(); i++)
+        y[i] = int8_t(-int(i));
+    cnpy::NpzSaveOptions aligned;
+    aligned.alignment = 64;
+    {
+        cnpy::NpzWriter npz("archive.npz");
+        npz.add("x", x.data(), {100, 4});
+        npz.add("y", y.data(), {17}, aligned);
+        npz.add("z", x.data(), {0, 4});
+    }
+
+    //round-trip, listing and on-demand loads
+    {
+        cnpy::NpzArchive npz("archive.npz");
+        CHECK(npz.arrays().size() == 3);
+        CHECK(npz.arrays()[0].name == "x" && npz.arrays()[1].name == "y" && npz.arrays()[2].name == "z");
+        const cnpy::NpzArrayInfo& info = npz.info("x");
+        CHECK(info.shape == std::vector<size_t>({100, 4}));
+        CHECK(info.dtype == cnpy::Type::Float && info.elemSize == sizeof(float));
+        CHECK(!info.fortranOrder && !info.compressed);
+        CHECK(npz.contains("y") && !npz.contains("w"));
+        CHECK_THROWS(npz.info("w"));
+        CHECK_THROWS(npz.load("w"));
+
+        checkArray(npz.load("x"), x, {100, 4});
+        checkArray(npz.load("y"), y, {17});
+        checkArray(npz.load("z"), x, {0, 4});
+        checkArray(npz.loadRows("x", 10, 5), x, {5, 4}, 10*4);
+
+        cnpy::NpArrayDict arrays = npz.loadAll(2);
+        CHECK(arrays.size() == 3);
+        checkArray(arrays["y"], y, {17});
+    }
+
+    const Bytes bytes = readFile("archive.npz");
+    const size_t cdOffset = centralDirectoryOffset(bytes);
+    const size_t headerX = centralHeader(bytes, "x.npy");
+    const size_t headerY = centralHeader(bytes, "y.npy");
+
+    //a corrupted array fails its CRC, unless the checks are disabled
+    {
+        Bytes corrupt = bytes;
+        const size_t local = le32(bytes, headerX+42);
+        const size_t dataOffset = local + 30 + (bytes[local+26] | bytes[local+27]<<8) + (bytes[local+28] | bytes[local+29]<<8);
+        corrupt[dataOffset + le32(bytes, headerX+20) - 1] ^= 0x40;
+        writeFile("corrupt.npz", corrupt);
+        CHECK_THROWS(cnpy::NpzArchive("corrupt.npz").load("x"));
+        CHECK_THROWS(cnpy::npz_load("corrupt.npz"));
+        cnpy::NpzArchive trusted("corrupt.npz", false);
+        CHECK(std::memcmp(trusted.load("x").data(), x.data(), x.size()*sizeof(float)) != 0);
+        checkArray(trusted.load("y"), y, {17});
+    }
+
+    //local header offsets past the entries or at the wrong entry
+    {
+        Bytes corrupt = bytes;
+        setLe32(corrupt, headerY+42, uint32_t(cdOffset + 8));
+        writeFile("corrupt.npz", corrupt);
+        CHECK_THROWS(cnpy::NpzArchive("corrupt.npz"));
+        CHECK_THROWS(cnpy::npz_load("corrupt.npz", "y"));
+
+        corrupt = bytes;
+        setLe32(corrupt, headerY+42, le32(bytes, headerX+42));
+        writeFile("corrupt.npz", corrupt);
+        CHECK_THROWS(cnpy::NpzArchive("corrupt.npz"));
+
+        corrupt = bytes;
+        setLe32(corrupt, headerY+42, le32(bytes, headerY+42) + 1);
+        writeFile("corrupt.npz", corrupt);
+        CHECK_THROWS(cnpy::NpzArchive("corrupt.npz"));
+    }
+
+    //truncated central directories
+    {
+        Bytes corrupt(bytes.begin(), bytes.begin() + (cdOffset + bytes.size()-22)/2);
+        corrupt.insert(corrupt.end(), bytes.end()-22, bytes.end());
+        writeFile("corrupt.npz", corrupt);
+        CHECK_THROWS(cnpy::NpzArchive("corrupt.npz"));
+        CHECK_THROWS(cnpy::npz_load("corrupt.npz"));
+
+        corrupt = bytes;
+        corrupt[corrupt.size()-22+8]++;     //one more entry than written
+        corrupt[corrupt.size()-22+10]++;
+        writeFile("corrupt.npz", corrupt);
+        CHECK_THROWS(cnpy::NpzArchive("corrupt.npz"));
+
+        corrupt.assign(bytes.begin(), bytes.end()-10);
+        writeFile("corrupt.npz", corrupt);
+        CHECK_THROWS(cnpy::NpzArchive("corrupt.npz"));
+        CHECK_THROWS(cnpy::npz_load("corrupt.npz"));
+    }
+
+    //more entries than the 16 bits counts hold need the zip64 records
+    const size_t N = 65536 + 10;
+    {
+        cnpy::NpzWriter npz("zip64.npz");
+        for(size_t i = 0; i < N; i++)
+            npz.add("a" + std::to_string(i), x.data()+i%100, {1});
+    }
+    const Bytes zip64 = readFile("zip64.npz");
+    CHECK(zip64[zip64.size()-22+10] == 0xFF && zip64[zip64.size()-22+11] == 0xFF);
+    CHECK(le32(zip64, zip64.size()-22-20) == 0x07064b50);
+    {
+        cnpy::NpzArchive npz("zip64.npz");
+        CHECK(npz.arrays().size() == N);
+        checkArray(npz.load("a0"), x, {1});
+        checkArray(npz.load("a65545"), x, {1}, 65545%100);
+    }
+    CHECK(cnpy::npz_load("zip64.npz").size() == N);
+
+    //zip64 counts and offsets that do not fit the file
+    {
+        const size_t record64 = le32(zip64, zip64.size()-22-20+8);
+        Bytes corrupt = zip64;
+        setLe32(corrupt, record64+48, 0xFFFFFFF8);
+        setLe32(corrupt, record64+52, 0xFFFFFFFF);
+        writeFile("corrupt.npz", corrupt);
+        CHECK_THROWS(cnpy::NpzArchive("corrupt.npz"));
+
+        corrupt = zip64;
+        setLe32(corrupt, record64+36, 0x40000000);
+        writeFile("corrupt.npz", corrupt);
+        CHECK_THROWS(cnpy::NpzArchive("corrupt.npz"));
+        CHECK_THROWS(cnpy::npz_load("corrupt.npz"));
+    }
+
+    std::cout << "npz archive test passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cnpy.h"
+#include "check.h"
+#include "zip_bytes.h"
+
+const size_t N = 200000;
+
+template<typename T> static void checkArray(const cnpy::NpArray& arr, const std::vector<T>& data)
+{
+    CHECK(arr.nDims() == 1 && arr.shape(0) == data.size());
+    CHECK(std::memcmp(arr.data(), data.data(), data.size()*sizeof(T)) == 0);
+}
+
+int main()
+{
+    //random bits do not compress, zeros and ramps do
+    std::vector<uint64_t> random(N);
+    uint64_t state = 12345;
+    for(size_t i = 0; i < N; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        random[i] = state;
+    }
+    const std::vector<uint64_t> zeros(N, 0);
+    std::vector<int32_t> ramp(N);
+    for(size_t i = 0; i < N; i++)
+        ramp[i] = int32_t(i/10);
+    const std::vector<float> small(100, 1.5f);
+
+    cnpy::NpzSaveOptions automatic;
+    automatic.compression = cnpy::Compression::Auto;
+    {
+        cnpy::NpzWriter npz("auto.npz", 'w', automatic);
+        npz.add("random", random.data(), {N});
+        npz.add("zeros", zeros.data(), {N});
+        npz.add("ramp", ramp.data(), {N});
+        npz.add("small", small.data(), {small.size()});
+        npz.add("empty", zeros.data(), {0});
+
+        //a stored array is left unfiltered, so that numpy reads it
+        cnpy::NpzSaveOptions filtered = automatic;
+        filtered.filter = cnpy::Filter::Shuffle;
+        filtered.level = 9;
+        npz.add("random_shuffle", random.data(), {N}, filtered);
+        npz.add("ramp_shuffle", ramp.data(), {N}, filtered);
+    }
+
+    cnpy::NpzArchive npz("auto.npz");
+    CHECK(!npz.info("random").compressed);
+    CHECK(npz.info("zeros").compressed);
+    CHECK(npz.info("ramp").compressed);
+    CHECK(npz.info("small").compressed);
+    CHECK(!npz.info("empty").compressed);
+    CHECK(!npz.info("random_shuffle").compressed);
+    CHECK(npz.info("ramp_shuffle").compressed);
+
+    checkArray(npz.load("random"), random);
+    checkArray(npz.load("zeros"), zeros);
+    checkArray(npz.load("ramp"), ramp);
+    checkArray(npz.load("small"), small);
+    checkArray(npz.load("random_shuffle"), random);
+    checkArray(npz.load("ramp_shuffle"), ramp);
+    checkArray(cnpy::npz_mmap("auto.npz", "random"), random);
+    CHECK(cnpy::npz_load("auto.npz").size() == 7);
+
+    //stored random data and barely anything for the rest
+    const size_t size = readFile("auto.npz").size();
+    CHECK(size > 2*N*sizeof(uint64_t));
+    CHECK(size < 2*N*sizeof(uint64_t) + N*sizeof(int32_t));
+
+    //levels out of the deflate range are rejected, as with Compression::Deflate
+    cnpy::NpzSaveOptions badLevel = automatic;
+    badLevel.level = 10;
+    CHECK_THROWS(cnpy::npz_save("auto.npz", "bad", ramp.data(), {N}, 'a', badLevel));
+    CHECK(readFile("auto.npz").size() == size);
+
+    std::cout << "npz auto test passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "cnpy.h"
+#include "check.h"
+
+const size_t N = 1000;
+
+static void checkArray(const std::shared_ptr<const cnpy::NpArray>& arr, const std::vector<double>& data)
+{
+    CHECK(arr && arr->nDims() == 1 && arr->shape(0) == data.size());
+    CHECK(std::memcmp(arr->data(), data.data(), data.size()*sizeof(double)) == 0);
+}
+
+//rewrite the archive with arrays of the same size, and move its modification time
+//forward so that only the time tells the two versions apart
+static void rewrite(const std::vector<double>& a, const std::vector<double>& b)
+{
+    struct stat st;
+    CHECK(::stat("cache.npz", &st) == 0);
+    cnpy::npz_save("cache.npz", "a", a.data(), {a.size()}, 'w');
+    cnpy::npz_save("cache.npz", "b", b.data(), {b.size()}, 'a');
+    timespec times[2] = {st.st_atim, st.st_mtim};
+    times[1].tv_sec += 10;
+    CHECK(::utimensat(AT_FDCWD, "cache.npz", times, 0) == 0);
+}
+
+int main()
+{
+    std::vector<double> a(N), b(N), c(N), big(4*N);
+    for(size_t i = 0; i < N; i++)
+    {
+        a[i] = i;
+        b[i] = -double(i);
+        c[i] = 0.5*i;
+    }
+    cnpy::npz_save("cache.npz", "a", a.data(), {N}, 'w');
+    cnpy::npz_save("cache.npz", "b", b.data(), {N}, 'a');
+    cnpy::npz_save("other.npz", "c", c.data(), {N}, 'w');
+    cnpy::npz_save("other.npz", "big", big.data(), {big.size()}, 'a');
+
+    //room for two arrays
+    cnpy::NpzCache cache(2*N*sizeof(double) + 100);
+
+    const std::shared_ptr<const cnpy::NpArray> a1 = cache.load("cache.npz", "a");
+    checkArray(a1, a);
+    CHECK(cache.bytes() == N*sizeof(double));
+    CHECK(cache.load("cache.npz", "a") == a1);
+
+    const std::shared_ptr<const cnpy::NpArray> b1 = cache.load("cache.npz", "b");
+    checkArray(b1, b);
+    CHECK(cache.bytes() == 2*N*sizeof(double));
+
+    //"a" is used again, so loading "c" evicts "b"
+    CHECK(cache.load("cache.npz", "a") == a1);
+    checkArray(cache.load("other.npz", "c"), c);
+    CHECK(cache.bytes() == 2*N*sizeof(double));
+    CHECK(cache.load("cache.npz", "a") == a1);
+    const std::shared_ptr<const cnpy::NpArray> b2 = cache.load("cache.npz", "b");
+    CHECK(b2 != b1);
+    checkArray(b1, b);  //still valid after its eviction
+    checkArray(b2, b);
+
+    //arrays larger than the budget are not kept
+    const std::shared_ptr<const cnpy::NpArray> big1 = cache.load("other.npz", "big");
+    checkArray(big1, big);
+    CHECK(cache.load("other.npz", "big") != big1);
+    CHECK(cache.bytes() <= cache.budget());
+
+    CHECK_THROWS(cache.load("cache.npz", "missing"));
+    CHECK_THROWS(cache.load("missing.npz", "a"));
+
+    //a rewritten archive is loaded again
+    const std::shared_ptr<const cnpy::NpArray> b3 = cache.load("cache.npz", "b");
+    CHECK(cache.load("cache.npz", "b") == b3);
+    rewrite(c, a);
+    checkArray(cache.load("cache.npz", "a"), c);
+    checkArray(cache.load("cache.npz", "b"), a);
+    checkArray(b3, b);
+
+    cnpy::npz_save("cache.npz", "b", big.data(), {N}, 'a');
+    checkArray(cache.load("cache.npz", "b"), std::vector<double>(N, 0.0));
+
+    cache.clear();
+    CHECK(cache.bytes() == 0);
+    checkArray(cache.load("cache.npz", "a"), c);
+
+    std::cout << "npz cache test passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cnpy.h"
+#include "check.h"
+#include "zip_bytes.h"
+
+const size_t ROWS = 3000;
+const size_t COLS = 8;
+
+static void checkArray(const cnpy::NpArray& arr, const std::vector<float>& data,
+                       const size_t rows, const size_t first=0)
+{
+    CHECK(arr.nDims() == 2 && arr.shape(0) == rows && arr.shape(1) == COLS);
+    CHECK(arr.dtype() == cnpy::Type::Float);
+    CHECK(std::memcmp(arr.data(), &data[first*COLS], rows*COLS*sizeof(float)) == 0);
+}
+
+//an array compressed with `compression` reads back through every loader,
+//or, when cnpy is built without the codec, the save throws and writes nothing
+static void checkCodec(const cnpy::Compression compression, const bool available,
+                       const int maxLevel, const size_t versionNeeded, const std::vector<float>& data)
+{
+    cnpy::npz_save("codecs.npz", "stored", data.data(), {ROWS, COLS}, 'w');
+    const std::vector<unsigned char> before = readFile("codecs.npz");
+
+    cnpy::NpzSaveOptions options;
+    options.compression = compression;
+    if(!available)
+    {
+        CHECK_THROWS(cnpy::npz_save("codecs.npz", "a", data.data(), {ROWS, COLS}, 'a', options));
+        CHECK(readFile("codecs.npz") == before);
+        return;
+    }
+
+    const int levels[] = {-1, 1, maxLevel};
+    for(const int level: levels)
+    {
+        options.level = level;
+        options.numThreads = level==maxLevel ? 2 : 1;
+        cnpy::npz_save("codecs.npz", "a" + std::to_string(level+1), data.data(), {ROWS, COLS}, 'a', options);
+    }
+    CHECK(readFile("codecs.npz").size() < before.size() + 3*data.size()*sizeof(float));
+
+    //the version needed to extract is 6.3 for zstd; the private lz4 method keeps the default
+    const Bytes bytes = readFile("codecs.npz");
+    const size_t central = centralHeader(bytes, "a0.npy");
+    CHECK(le16(bytes, central+6) == versionNeeded);
+    CHECK(le16(bytes, le32(bytes, central+42)+4) == versionNeeded);
+
+    cnpy::NpzArchive npz("codecs.npz");
+    for(const int level: levels)
+    {
+        const std::string name = "a" + std::to_string(level+1);
+        CHECK(npz.info(name).compressed);
+        checkArray(npz.load(name), data, ROWS);
+        checkArray(npz.loadRows(name, 1000, 50), data, 50, 1000);
+        checkArray(cnpy::npz_load_rows("codecs.npz", name, ROWS-5, 5), data, 5, ROWS-5);
+    }
+    cnpy::NpArrayDict arrays = cnpy::npz_load("codecs.npz");
+    CHECK(arrays.size() == 4);
+    checkArray(arrays["a0"], data, ROWS);
+    checkArray(cnpy::npz_load_parallel("codecs.npz", 3)["a2"], data, ROWS);
+
+    //out of range levels and restart points are rejected up front
+    const std::vector<unsigned char> written = readFile("codecs.npz");
+    options.level = maxLevel+1;
+    CHECK_THROWS(cnpy::npz_save("codecs.npz", "bad", data.data(), {ROWS, COLS}, 'a', options));
+    options.level = -1;
+    options.seekRows = 100;
+    CHECK_THROWS(cnpy::npz_save("codecs.npz", "bad", data.data(), {ROWS, COLS}, 'a', options));
+    CHECK(readFile("codecs.npz") == written);
+}
+
+int main()
+{
+    std::vector<float> data(ROWS*COLS);
+    for(size_t i = 0; i < data.size(); i++)
+        data[i] = float(i/16) * 0.25f;
+
+#ifdef CNPY_HAVE_ZSTD
+    checkCodec(cnpy::Compression::Zstd, true, 22, 63, data);
+#else
+    checkCodec(cnpy::Compression::Zstd, false, 0, 0, data);
+#endif
+#ifdef CNPY_HAVE_LZ4
+    checkCodec(cnpy::Compression::Lz4, true, 12, 20, data);
+#else
+    checkCodec(cnpy::Compression::Lz4, false, 0, 0, data);
+#endif
+
+    std::cout << "npz codecs test passed" << std::endl;
+    return 0;
+}
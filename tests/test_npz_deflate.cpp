@@ -0,0 +1,123 @@
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "cnpy.h"
+#include "check.h"
+#include "zip_bytes.h"
+
+const size_t ROWS = 5000;
+const size_t COLS = 8;
+
+static void checkArray(const cnpy::NpArray& arr, const std::vector<double>& data,
+                       const size_t rows, const size_t first=0)
+{
+    CHECK(arr.nDims() == 2 && arr.shape(0) == rows && arr.shape(1) == COLS);
+    CHECK(arr.dtype() == cnpy::Type::Double);
+    CHECK(std::memcmp(arr.data(), &data[first*COLS], rows*COLS*sizeof(double)) == 0);
+}
+
+int main()
+{
+    //smooth data, that deflate shrinks
+    std::vector<double> data(ROWS*COLS);
+    for(size_t i = 0; i < data.size(); i++)
+        data[i] = double(i/64);
+
+    cnpy::NpzSaveOptions deflate;
+    deflate.compression = cnpy::Compression::Deflate;
+    {
+        cnpy::NpzWriter npz("deflate.npz", 'w', deflate);
+        npz.add("stored", data.data(), {ROWS, COLS}, cnpy::NpzSaveOptions());
+        npz.add("default", data.data(), {ROWS, COLS});
+        const int levels[] = {1, 6, 9};
+        for(const int level: levels)
+        {
+            cnpy::NpzSaveOptions options = deflate;
+            options.level = level;
+            options.alignment = 4096;  //ignored for compressed arrays
+            npz.add("level" + std::to_string(level), data.data(), {ROWS, COLS}, options);
+        }
+        npz.add("empty", data.data(), {0, COLS});
+    }
+    CHECK(readFile("deflate.npz").size() < 2*ROWS*COLS*sizeof(double));
+
+    cnpy::NpzArchive npz("deflate.npz");
+    CHECK(!npz.info("stored").compressed);
+    const char* names[] = {"default", "level1", "level6", "level9"};
+    for(const char* name: names)
+    {
+        CHECK(npz.info(name).compressed);
+        checkArray(npz.load(name), data, ROWS);
+        checkArray(npz.loadRows(name, 1234, 100), data, 100, 1234);
+    }
+    checkArray(npz.load("empty"), data, 0);
+
+    cnpy::NpArrayDict arrays = cnpy::npz_load("deflate.npz");
+    CHECK(arrays.size() == 6);
+    checkArray(arrays["level9"], data, ROWS);
+    arrays = cnpy::npz_load_parallel("deflate.npz", 4);
+    checkArray(arrays["level1"], data, ROWS);
+    checkArray(cnpy::npz_load_rows("deflate.npz", "default", ROWS-3, 10), data, 3, ROWS-3);
+    checkArray(cnpy::npz_mmap("deflate.npz", "level6"), data, ROWS);
+
+    //a damaged deflate stream is reported, not returned
+    {
+        cnpy::npz_save("damaged.npz", "a", data.data(), {ROWS, COLS}, 'w', deflate);
+        Bytes bytes = readFile("damaged.npz");
+        const size_t middle = bytes.size()/2;
+        for(size_t i = middle; i < middle+64; i++)
+            bytes[i] = 0xFF;
+        writeFile("damaged.npz", bytes);
+        CHECK_THROWS(cnpy::npz_load("damaged.npz"));
+    }
+
+    //an uncompressed size that the npy header does not explain is rejected before decoding
+    {
+        cnpy::npz_save("damaged.npz", "a", data.data(), {ROWS, COLS}, 'w', deflate);
+        Bytes bytes = readFile("damaged.npz");
+        setLe32(bytes, centralHeader(bytes, "a.npy")+24, 0xF0000000);
+        setLe32(bytes, 22, 0xF0000000);
+        writeFile("damaged.npz", bytes);
+        CHECK_THROWS(cnpy::NpzArchive("damaged.npz"));
+        CHECK_THROWS(cnpy::npz_load("damaged.npz"));
+        CHECK_THROWS(cnpy::npz_load("damaged.npz", "a"));
+    }
+
+    //arrays larger than 1 MB deflated on several threads, as one stream
+    std::vector<double> large(450000);
+    for(size_t i = 0; i < large.size(); i++)
+        large[i] = double(i%1000) + double(i/100000);
+    const unsigned threads[] = {2, 4, 0};
+    for(const unsigned numThreads: threads)
+    {
+        cnpy::NpzSaveOptions options = deflate;
+        options.numThreads = numThreads;
+        cnpy::npz_save("threads.npz", "large", large.data(), {large.size()/COLS, COLS}, 'w', options);
+        cnpy::npz_save("threads.npz", "small", data.data(), {ROWS, COLS}, 'a', options);
+        CHECK(readFile("threads.npz").size() < (large.size()+data.size())*sizeof(double)/2);
+
+        cnpy::NpzArchive archive("threads.npz");
+        CHECK(archive.info("large").compressed);
+        checkArray(archive.load("large"), large, large.size()/COLS);
+        checkArray(archive.loadRows("large", 40000, 1000), large, 1000, 40000);
+        checkArray(archive.load("small"), data, ROWS);
+    }
+
+    //invalid levels and thread counts throw before anything is written
+    const std::vector<unsigned char> before = readFile("deflate.npz");
+    const int badLevels[] = {-2, 0, 10, 42};
+    for(const int level: badLevels)
+    {
+        cnpy::NpzSaveOptions options = deflate;
+        options.level = level;
+        CHECK_THROWS(cnpy::npz_save("deflate.npz", "bad", data.data(), {ROWS, COLS}, 'a', options));
+    }
+    cnpy::NpzSaveOptions tooManyThreads = deflate;
+    tooManyThreads.numThreads = 100000;
+    CHECK_THROWS(cnpy::npz_save("deflate.npz", "bad", data.data(), {ROWS, COLS}, 'a', tooManyThreads));
+    CHECK(readFile("deflate.npz") == before);
+
+    std::cout << "npz deflate test passed" << std::endl;
+    return 0;
+}
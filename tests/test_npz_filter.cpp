@@ -0,0 +1,131 @@
+#include <complex>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cnpy.h"
+#include "check.h"
+#include "zip_bytes.h"
+
+const size_t ROWS = 40000;
+const size_t COLS = 4;
+
+//compression method in the central and local headers of `name`
+static void methods(const std::string& name, size_t& central, size_t& local)
+{
+    const Bytes bytes = readFile("filter.npz");
+    const size_t pos = centralHeader(bytes, name + ".npy");
+    central = le16(bytes, pos+10);
+    local = le16(bytes, le32(bytes, pos+42)+8);
+}
+
+static size_t compressedSize(const std::string& name)
+{
+    const Bytes bytes = readFile("filter.npz");
+    return le32(bytes, centralHeader(bytes, name + ".npy")+20);
+}
+
+template<typename T> static void checkArray(const cnpy::NpArray& arr, const std::vector<T>& data,
+                                            const size_t rows, const size_t first=0)
+{
+    CHECK(arr.nDims() == 2 && arr.shape(0) == rows && arr.shape(1) == COLS);
+    CHECK(arr.dtype() == cnpy::type<T>());
+    CHECK(std::memcmp(arr.data(), &data[first*COLS], rows*COLS*sizeof(T)) == 0);
+}
+
+//every loader returns the original data of `name`
+template<typename T> static void checkLoads(const std::string& name, const std::vector<T>& data)
+{
+    cnpy::NpzArchive npz("filter.npz");
+    CHECK(npz.info(name).compressed);
+    checkArray(npz.load(name), data, ROWS);
+    checkArray(npz.loadRows(name, 12345, 3000), data, 3000, 12345);
+    checkArray(npz.loadRows(name, ROWS-1, 1), data, 1, ROWS-1);
+    checkArray(cnpy::npz_load("filter.npz", name), data, ROWS);
+    checkArray(cnpy::npz_load("filter.npz")[name], data, ROWS);
+    checkArray(cnpy::npz_load_parallel("filter.npz", 3)[name], data, ROWS);
+    checkArray(cnpy::npz_load_rows("filter.npz", name, 30000, 17), data, 17, 30000);
+}
+
+//filtered entries never carry the deflate method, the filter field holds it
+static void checkPrivateMethod(const std::string& name)
+{
+    size_t central, local;
+    methods(name, central, local);
+    CHECK(central != 0 && central != 8);
+    CHECK(local == central);
+}
+
+template<typename T> static void checkType(const std::vector<T>& data, const std::string& type)
+{
+    cnpy::NpzSaveOptions options;
+    options.compression = cnpy::Compression::Deflate;
+    cnpy::npz_save("filter.npz", type + "_plain", data.data(), {ROWS, COLS}, 'a', options);
+
+    const cnpy::Filter filters[] = {cnpy::Filter::Shuffle, cnpy::Filter::BitShuffle};
+    for(const cnpy::Filter filter: filters)
+    {
+        const std::string name = type + (filter==cnpy::Filter::Shuffle ? "_shuffle" : "_bitshuffle");
+        options.filter = filter;
+        options.numThreads = 1;
+        options.seekRows = 0;
+        cnpy::npz_save("filter.npz", name, data.data(), {ROWS, COLS}, 'a', options);
+        checkLoads(name, data);
+        checkPrivateMethod(name);
+
+        //the pigz style blocks and the restart points work on the filtered bytes
+        options.numThreads = 4;
+        options.seekRows = 1000;
+        cnpy::npz_save("filter.npz", name + "_seek", data.data(), {ROWS, COLS}, 'a', options);
+        checkLoads(name + "_seek", data);
+        checkPrivateMethod(name + "_seek");
+    }
+}
+
+int main()
+{
+    //slowly varying values, whose high bytes repeat
+    std::vector<int16_t> shorts(ROWS*COLS);
+    std::vector<float> floats(ROWS*COLS);
+    std::vector<double> doubles(ROWS*COLS);
+    std::vector<std::complex<double>> complexes(ROWS*COLS);
+    for(size_t i = 0; i < ROWS*COLS; i++)
+    {
+        shorts[i] = int16_t(i/7);
+        floats[i] = 1000.0f + 0.01f*float(i%5000);
+        doubles[i] = 1.0 + 1e-6*double(i);
+        complexes[i] = std::complex<double>(double(i), -double(i/3));
+    }
+
+    cnpy::npz_save("filter.npz", "dummy", shorts.data(), {1}, 'w');
+    checkType(shorts, "shorts");
+    checkType(floats, "floats");
+    checkType(doubles, "doubles");
+    checkType(complexes, "complexes");
+
+    //the shuffle makes these arrays smaller
+    CHECK(compressedSize("doubles_shuffle") < compressedSize("doubles_plain"));
+    CHECK(compressedSize("floats_bitshuffle") < compressedSize("floats_plain"));
+
+    //stored arrays are never filtered, so numpy still reads them
+    cnpy::NpzSaveOptions stored;
+    stored.filter = cnpy::Filter::Shuffle;
+    cnpy::npz_save("filter.npz", "stored", doubles.data(), {ROWS, COLS}, 'a', stored);
+    size_t central, local;
+    methods("stored", central, local);
+    CHECK(central == 0 && local == 0);
+    checkArray(cnpy::npz_mmap("filter.npz", "stored"), doubles, ROWS);
+
+    //unknown filters are rejected before anything is written
+    const Bytes before = readFile("filter.npz");
+    cnpy::NpzSaveOptions bad;
+    bad.compression = cnpy::Compression::Deflate;
+    bad.filter = cnpy::Filter(7);
+    CHECK_THROWS(cnpy::npz_save("filter.npz", "bad", doubles.data(), {ROWS, COLS}, 'a', bad));
+    CHECK(readFile("filter.npz") == before);
+
+    std::cout << "npz filter test passed" << std::endl;
+    return 0;
+}
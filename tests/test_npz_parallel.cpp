@@ -0,0 +1,61 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cnpy.h"
+#include "check.h"
+
+static void checkSame(const cnpy::NpArrayDict& arrays, const cnpy::NpArrayDict& expected)
+{
+    CHECK(arrays.size() == expected.size());
+    for(const cnpy::NpArrayDict::value_type& item: expected)
+    {
+        const cnpy::NpArrayDict::const_iterator it = arrays.find(item.first);
+        CHECK(it != arrays.end());
+        const cnpy::NpArray& arr = it->second;
+        CHECK(arr.nDims() == item.second.nDims());
+        for(size_t i = 0; i < arr.nDims(); i++)
+            CHECK(arr.shape(i) == item.second.shape(i));
+        CHECK(arr.dtype() == item.second.dtype());
+        CHECK(arr.size() == item.second.size());
+        CHECK(std::memcmp(arr.data(), item.second.data(), arr.size()) == 0);
+    }
+}
+
+int main()
+{
+    //one big array and many small ones of various sizes
+    std::vector<int64_t> data(1 << 20);
+    for(size_t i = 0; i < data.size(); i++)
+        data[i] = int64_t(i*i);
+    {
+        cnpy::NpzWriter npz("parallel.npz");
+        npz.add("big", data.data(), {data.size()});
+        for(size_t i = 0; i < 50; i++)
+            npz.add("small" + std::to_string(i), data.data()+i, {i*37, 1});
+        npz.add("empty", data.data(), {0});
+    }
+
+    const cnpy::NpArrayDict expected = cnpy::npz_load("parallel.npz");
+    CHECK(expected.size() == 52);
+    const unsigned threads[] = {1, 3, 16, 0};
+    for(const unsigned numThreads: threads)
+        checkSame(cnpy::npz_load_parallel("parallel.npz", numThreads), expected);
+
+    //a byte flipped in the middle of the big array fails its CRC check
+    std::FILE* fp = std::fopen("parallel.npz", "r+b");
+    CHECK(fp != nullptr);
+    CHECK(std::fseek(fp, 4*data.size(), SEEK_SET) == 0);
+    const int c = std::fgetc(fp);
+    CHECK(std::fseek(fp, 4*data.size(), SEEK_SET) == 0);
+    std::fputc(c ^ 0x01, fp);
+    std::fclose(fp);
+    CHECK_THROWS(cnpy::npz_load_parallel("parallel.npz", 4));
+
+    CHECK_THROWS(cnpy::npz_load_parallel("missing.npz"));
+
+    std::cout << "npz parallel test passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+#include "cnpy.h"
+#include "check.h"
+
+const size_t N = 1000;
+
+static size_t fileSize(const std::string& fname)
+{
+    std::ifstream file(fname, std::ios::binary | std::ios::ate);
+    return size_t(file.tellg());
+}
+
+static void checkArray(const cnpy::NpArray& arr, const std::vector<double>& data, const size_t count)
+{
+    CHECK(arr.nDims() == 1 && arr.shape(0) == count);
+    CHECK(std::memcmp(arr.data(), data.data(), count*sizeof(double)) == 0);
+}
+
+//check that "a" and "b" in the archive still hold the original data
+static void checkOriginal(const std::vector<double>& data)
+{
+    cnpy::NpArrayDict arrays = cnpy::npz_load("replace.npz");
+    CHECK(arrays.size() == 2);
+    checkArray(arrays["a"], data, N);
+    checkArray(arrays["b"], data, N);
+}
+
+//replacing an array with a save that throws must keep the old one
+static void replaceWith(const std::vector<double>& other, const cnpy::NpzSaveOptions& options,
+                        const std::vector<double>& data)
+{
+    CHECK_THROWS(cnpy::npz_save("replace.npz", "a", other.data(), {other.size()}, 'a', options));
+    checkOriginal(data);
+}
+
+int main()
+{
+    std::vector<double> data(N);
+    for(size_t i = 0; i < N; i++)
+        data[i] = 0.5*i;
+    const std::vector<double> other(100*N, 1.0);
+
+    cnpy::npz_save("replace.npz", "a", data.data(), {N}, 'w');
+    cnpy::npz_save("replace.npz", "b", data.data(), {N}, 'a');
+
+    cnpy::NpzSaveOptions badAlignment;
+    badAlignment.alignment = 1 << 20;
+    replaceWith(other, badAlignment, data);
+
+    cnpy::NpzSaveOptions badLevel;
+    badLevel.compression = cnpy::Compression::Deflate;
+    badLevel.level = 42;
+    replaceWith(other, badLevel, data);
+
+    //codecs cnpy is built without, or levels out of their range
+    cnpy::NpzSaveOptions zstd;
+    zstd.compression = cnpy::Compression::Zstd;
+#ifdef CNPY_HAVE_ZSTD
+    zstd.level = 100;
+#endif
+    replaceWith(other, zstd, data);
+
+    cnpy::NpzSaveOptions lz4;
+    lz4.compression = cnpy::Compression::Lz4;
+#ifdef CNPY_HAVE_LZ4
+    lz4.level = 100;
+#endif
+    replaceWith(other, lz4, data);
+
+    cnpy::NpzSaveOptions badThreads;
+    badThreads.compression = cnpy::Compression::Deflate;
+    badThreads.numThreads = 100000;
+    replaceWith(other, badThreads, data);
+
+    cnpy::NpzSaveOptions badMantissa;
+    badMantissa.mantissaBits = -2;
+    replaceWith(other, badMantissa, data);
+
+    //a write that fails half way, here because the file may not grow past
+    //its current size, is rolled back to the directory from before
+    {
+        std::signal(SIGXFSZ, SIG_IGN);
+        rlimit limit;
+        CHECK(getrlimit(RLIMIT_FSIZE, &limit) == 0);
+        rlimit small = limit;
+        small.rlim_cur = fileSize("replace.npz") + 4096;
+        CHECK(setrlimit(RLIMIT_FSIZE, &small) == 0);
+        bool thrown = false;
+        try
+        {
+            cnpy::npz_save("replace.npz", "a", other.data(), {other.size()}, 'a');
+        }
+        catch(std::runtime_error&)
+        {
+            thrown = true;
+        }
+        CHECK(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+        CHECK(thrown);
+        checkOriginal(data);
+    }
+
+    //replacing and removing only rewrite the central directory
+    const size_t size = fileSize("replace.npz");
+    cnpy::npz_save("replace.npz", "a", other.data(), {other.size()}, 'a');
+    CHECK(fileSize("replace.npz") > size + other.size()*sizeof(double));
+    checkArray(cnpy::npz_load("replace.npz", "a"), other, other.size());
+    checkArray(cnpy::npz_load("replace.npz", "b"), data, N);
+
+    CHECK(cnpy::npz_remove("replace.npz", "a"));
+
+    //removing a missing array does not write to the file
+    const struct utimbuf old = {1000000, 1000000};
+    CHECK(utime("replace.npz", &old) == 0);
+    CHECK(!cnpy::npz_remove("replace.npz", "a"));
+    CHECK(!cnpy::npz_remove("replace.npz", "missing"));
+    struct stat st;
+    CHECK(stat("replace.npz", &st) == 0 && st.st_mtime == old.modtime);
+    CHECK_THROWS(cnpy::npz_remove("missing.npz", "a"));
+    CHECK(fileSize("replace.npz") > size + other.size()*sizeof(double) - 1024);
+    CHECK(cnpy::npz_load("replace.npz").size() == 1);
+
+    //compact() moves the live arrays over the dead bytes, keeping their alignment
+    cnpy::NpzSaveOptions aligned;
+    aligned.alignment = 4096;
+    cnpy::npz_save("replace.npz", "c", data.data(), {N}, 'a', aligned);
+    {
+        cnpy::NpzWriter npz("replace.npz", 'a');
+        CHECK(!npz.compact(0.99));
+        CHECK(npz.compact(0.5));
+        CHECK(!npz.compact());
+    }
+    CHECK(fileSize("replace.npz") < 2*4096 + 2*N*sizeof(double) + 1024);
+
+    cnpy::NpArrayDict arrays = cnpy::npz_mmap("replace.npz");
+    CHECK(arrays.size() == 2);
+    checkArray(arrays["b"], data, N);
+    checkArray(arrays["c"], data, N);
+    CHECK(reinterpret_cast<uintptr_t>(arrays["c"].data()) % 4096 == 0);
+
+    std::cout << "npz replace test passed" << std::endl;
+    return 0;
+}
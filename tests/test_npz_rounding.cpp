@@ -0,0 +1,160 @@
+#include <cfloat>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "cnpy.h"
+#include "check.h"
+#include "zip_bytes.h"
+
+const size_t N = 100000;
+
+static uint32_t bits(const float x)
+{
+    uint32_t b;
+    std::memcpy(&b, &x, 4);
+    return b;
+}
+
+static uint64_t bits(const double x)
+{
+    uint64_t b;
+    std::memcpy(&b, &x, 8);
+    return b;
+}
+
+//the values of `arr` are those of `data` rounded to `mantissaBits` bits, within the relative bound
+template<typename T> static void checkRounded(const cnpy::NpArray& arr, const std::vector<T>& data,
+                                              const int mantissaBits, const int available)
+{
+    CHECK(arr.nDims() == 1 && arr.shape(0) == data.size());
+    const T* rounded = reinterpret_cast<const T*>(arr.data());
+    for(size_t i = 0; i < data.size(); i++)
+    {
+        CHECK(std::fabs(rounded[i]-data[i]) <= std::ldexp(std::fabs(data[i]), -(mantissaBits+1)));
+        CHECK((bits(rounded[i]) & ((decltype(bits(T()))(1) << (available-mantissaBits)) - 1)) == 0);
+    }
+}
+
+int main()
+{
+    cnpy::NpzSaveOptions options;
+    options.mantissaBits = 1;
+
+    //ties go to the even mantissa, values that would overflow are truncated,
+    //NaNs and infinities are kept
+    const float inf = std::numeric_limits<float>::infinity();
+    const std::vector<float> special = {1.25f, 1.75f, -1.25f, 1.125f, 0.0f, FLT_MAX, inf, -inf,
+                                        std::numeric_limits<float>::quiet_NaN(), 3.0f, 2.5f, 1e-40f};
+    double maxError = 0;
+    options.maxError = &maxError;
+    cnpy::npz_save("rounding.npz", "special", special.data(), {special.size()}, 'w', options);
+    const cnpy::NpArray arr = cnpy::npz_load("rounding.npz", "special");
+    const float* rounded = reinterpret_cast<const float*>(arr.data());
+    CHECK(rounded[0] == 1.0f);
+    CHECK(rounded[1] == 2.0f);
+    CHECK(rounded[2] == -1.0f);
+    CHECK(rounded[3] == 1.0f);
+    CHECK(rounded[4] == 0.0f);
+    CHECK(bits(rounded[5]) == 0x7F400000);
+    CHECK(rounded[6] == inf && rounded[7] == -inf);
+    CHECK(std::isnan(rounded[8]));
+    CHECK(rounded[9] == 3.0f);
+    CHECK(rounded[10] == 2.0f);
+    CHECK(rounded[11] == 0.0f);
+    CHECK(maxError == double(FLT_MAX) - double(rounded[5]));
+
+    //arrays long enough for the vector kernels, stored and deflated
+    std::vector<float> floats(N);
+    std::vector<double> doubles(N);
+    std::vector<std::complex<double>> complexes(N);
+    for(size_t i = 0; i < N; i++)
+    {
+        floats[i] = std::sin(0.001f*float(i)) * 100.0f;
+        doubles[i] = std::exp(1e-4*double(i)) - 3.0;
+        complexes[i] = std::complex<double>(std::cos(1e-3*double(i)), double(i)/7.0);
+    }
+    //stored, deflated, deflated on several threads with a filter, and chosen per array
+    const cnpy::Compression compressions[] = {cnpy::Compression::None, cnpy::Compression::Deflate,
+                                              cnpy::Compression::Deflate, cnpy::Compression::Auto};
+    for(size_t c = 0; c < 4; c++)
+    {
+        const cnpy::Compression compression = compressions[c];
+        options.compression = compression;
+        options.numThreads = c == 2 ? 4 : 1;
+        options.filter = c == 2 ? cnpy::Filter::Shuffle : cnpy::Filter::None;
+        options.mantissaBits = 7;
+        maxError = 0;
+        cnpy::npz_save("rounding.npz", "floats", floats.data(), {N}, 'w', options);
+        const double floatError = maxError;
+        CHECK(floatError > 0 && floatError <= 100.0/256);
+        options.mantissaBits = 20;
+        cnpy::npz_save("rounding.npz", "doubles", doubles.data(), {N}, 'a', options);
+        cnpy::npz_save("rounding.npz", "complexes", complexes.data(), {N}, 'a', options);
+        CHECK(maxError == floatError);
+
+        cnpy::NpzArchive npz("rounding.npz");
+        if(compression != cnpy::Compression::Auto)
+            CHECK(npz.info("floats").compressed == (compression != cnpy::Compression::None));
+        checkRounded(npz.load("floats"), floats, 7, 23);
+
+        //the reported error is the exact one, for the arrays saved only
+        const cnpy::NpArray roundedFloats = npz.load("floats");
+        const cnpy::NpArray roundedDoubles = npz.load("doubles");
+        double floatExact = 0;
+        double doubleExact = 0;
+        for(size_t i = 0; i < N; i++)
+        {
+            floatExact = std::max(floatExact, std::fabs(double(floats[i]) - double(reinterpret_cast<const float*>(roundedFloats.data())[i])));
+            doubleExact = std::max(doubleExact, std::fabs(doubles[i] - reinterpret_cast<const double*>(roundedDoubles.data())[i]));
+        }
+        CHECK(floatError == floatExact);
+        CHECK(doubleExact > 0 && doubleExact <= floatError);
+        checkRounded(npz.load("doubles"), doubles, 20, 52);
+        const std::vector<double> parts(reinterpret_cast<const double*>(complexes.data()),
+                                        reinterpret_cast<const double*>(complexes.data()) + 2*N);
+        const cnpy::NpArray loaded = npz.load("complexes");
+        CHECK(loaded.dtype() == cnpy::Type::ComplexDouble);
+        const std::vector<double> loadedParts(reinterpret_cast<const double*>(loaded.data()),
+                                              reinterpret_cast<const double*>(loaded.data()) + 2*N);
+        for(size_t i = 0; i < 2*N; i++)
+            CHECK(std::fabs(loadedParts[i]-parts[i]) <= std::ldexp(std::fabs(parts[i]), -21));
+    }
+
+    //the rounded data compresses better
+    cnpy::NpzSaveOptions deflate;
+    deflate.compression = cnpy::Compression::Deflate;
+    cnpy::npz_save("plain.npz", "doubles", doubles.data(), {N}, 'w', deflate);
+    deflate.mantissaBits = 10;
+    cnpy::npz_save("rounded.npz", "doubles", doubles.data(), {N}, 'w', deflate);
+    CHECK(2*readFile("rounded.npz").size() < readFile("plain.npz").size());
+
+    //integer arrays and full mantissas are left untouched
+    std::vector<int32_t> ints(1000);
+    for(size_t i = 0; i < ints.size(); i++)
+        ints[i] = int32_t(i*2654435761u);
+    deflate.mantissaBits = 0;
+    cnpy::npz_save("rounded.npz", "ints", ints.data(), {ints.size()}, 'a', deflate);
+    CHECK(std::memcmp(cnpy::npz_load("rounded.npz", "ints").data(), ints.data(), ints.size()*4) == 0);
+    deflate.mantissaBits = 52;
+    cnpy::npz_save("rounded.npz", "full", doubles.data(), {N}, 'a', deflate);
+    CHECK(std::memcmp(cnpy::npz_load("rounded.npz", "full").data(), doubles.data(), N*8) == 0);
+
+    //negative counts other than -1 are rejected before anything is written
+    const std::vector<unsigned char> before = readFile("rounded.npz");
+    cnpy::NpzSaveOptions bad;
+    bad.mantissaBits = -2;
+    maxError = 0;
+    bad.maxError = &maxError;
+    CHECK_THROWS(cnpy::npz_save("rounded.npz", "bad", doubles.data(), {N}, 'a', bad));
+    CHECK(readFile("rounded.npz") == before);
+    CHECK(maxError == 0);
+
+    std::cout << "npz rounding test passed" << std::endl;
+    return 0;
+}
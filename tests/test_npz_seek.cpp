@@ -0,0 +1,102 @@
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cnpy.h"
+#include "check.h"
+#include "zip_bytes.h"
+
+const size_t ROWS = 20000;
+const size_t COLS = 8;
+
+static void checkRows(const cnpy::NpArray& arr, const std::vector<double>& data, const size_t first, const size_t count)
+{
+    CHECK(arr.nDims() == 2 && arr.shape(0) == count && arr.shape(1) == COLS);
+    CHECK(std::memcmp(arr.data(), &data[first*COLS], count*COLS*sizeof(double)) == 0);
+}
+
+//row reads of every size, from anywhere in the array
+static void checkReads(const std::string& fname, const std::string& name, const std::vector<double>& data)
+{
+    const size_t firsts[] = {0, 1, 99, 100, 101, 5555, 10000, ROWS-101, ROWS-1};
+    const size_t counts[] = {1, 7, 100, 250};
+    cnpy::NpzArchive npz(fname);
+    for(const size_t first: firsts)
+        for(const size_t count: counts)
+        {
+            const size_t n = std::min(count, ROWS-first);
+            checkRows(npz.loadRows(name, first, n), data, first, n);
+            checkRows(cnpy::npz_load_rows(fname, name, first, n), data, first, n);
+        }
+    checkRows(npz.load(name), data, 0, ROWS);
+}
+
+int main()
+{
+    //values that deflate can not shrink much, so that each segment takes some room
+    std::vector<double> data(ROWS*COLS);
+    uint64_t state = 1;
+    for(size_t i = 0; i < data.size(); i++)
+    {
+        state = state*6364136223846793005ULL + 1442695040888963407ULL;
+        data[i] = double(state >> 40);
+    }
+
+    cnpy::NpzSaveOptions options;
+    options.compression = cnpy::Compression::Deflate;
+    options.seekRows = 100;
+    const unsigned threads[] = {1, 4};
+    for(const unsigned numThreads: threads)
+    {
+        options.numThreads = numThreads;
+        cnpy::npz_save("seek.npz", "x", data.data(), {ROWS, COLS}, 'w', options);
+        checkReads("seek.npz", "x", data);
+
+        //the restart points are not an entry of their own: numpy lists the array only
+        CHECK(entryNames(readFile("seek.npz")) == std::vector<std::string>({"x.npy"}));
+    }
+
+    //rows past a damaged segment are still read through a restart point,
+    //while a read from the start decodes the damage
+    {
+        Bytes bytes = readFile("seek.npz");
+        const size_t local = le32(bytes, centralDirectoryOffset(bytes)+42);
+        const size_t dataOffset = local + 30 + le16(bytes, local+26) + le16(bytes, local+28);
+        for(size_t i = dataOffset+500; i < dataOffset+600; i++)
+            bytes[i] ^= 0x5A;
+        writeFile("damaged.npz", bytes);
+        CHECK_THROWS(cnpy::npz_load("damaged.npz", "x"));
+        checkRows(cnpy::npz_load_rows("damaged.npz", "x", ROWS-150, 120), data, ROWS-150, 120);
+        checkRows(cnpy::NpzArchive("damaged.npz", false).loadRows("x", 5000, 10), data, 5000, 10);
+    }
+
+    //the points follow the array when others are appended, replaced and compacted
+    options.numThreads = 2;
+    cnpy::npz_save("seek.npz", "y", data.data(), {ROWS, COLS}, 'a', options);
+    cnpy::npz_save("seek.npz", "x", data.data(), {ROWS, COLS}, 'a');
+    {
+        cnpy::NpzWriter npz("seek.npz", 'a');
+        CHECK(npz.remove("x"));
+        CHECK(npz.compact());
+    }
+    checkReads("seek.npz", "y", data);
+    CHECK(entryNames(readFile("seek.npz")) == std::vector<std::string>({"y.npy"}));
+
+    //a restart point every row is widened to what fits the central directory,
+    //so the encoder is not flushed more often than the points kept
+    for(const unsigned numThreads: threads)
+    {
+        options.numThreads = numThreads;
+        options.seekRows = 1;
+        cnpy::npz_save("seek.npz", "x", data.data(), {ROWS, COLS}, 'w', options);
+        checkReads("seek.npz", "x", data);
+        options.seekRows = (ROWS+3999)/4000;
+        cnpy::npz_save("widened.npz", "x", data.data(), {ROWS, COLS}, 'w', options);
+        CHECK(readFile("seek.npz").size() == readFile("widened.npz").size());
+    }
+
+    std::cout << "npz seek test passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cnpy.h"
+#include "check.h"
+
+const size_t ARRAYS = 20;
+const size_t THREADS = 8;
+
+static std::vector<int32_t> values(const size_t i)
+{
+    std::vector<int32_t> data((i+1)*1000);
+    for(size_t j = 0; j < data.size(); j++)
+        data[j] = int32_t(i*1000000 + j);
+    return data;
+}
+
+//every thread loads all the arrays several times, whole or by rows
+static void loadArrays(const cnpy::NpzArchive& npz, const size_t seed)
+{
+    for(size_t n = 0; n < 10*ARRAYS; n++)
+    {
+        const size_t i = (seed*7 + n*13) % ARRAYS;
+        const std::string name = "a" + std::to_string(i);
+        const std::vector<int32_t> data = values(i);
+        if(n%3 == 0)
+        {
+            const cnpy::NpArray rows = npz.loadRows(name, i, 2);
+            CHECK(rows.shape(0) == 2 && rows.shape(1) == 10);
+            CHECK(std::memcmp(rows.data(), &data[i*10], rows.size()) == 0);
+        }
+        else
+        {
+            const cnpy::NpArray arr = npz.load(name);
+            CHECK(arr.size() == data.size()*sizeof(int32_t));
+            CHECK(std::memcmp(arr.data(), data.data(), arr.size()) == 0);
+        }
+    }
+}
+
+int main()
+{
+    {
+        //every other array is deflated, each thread then reuses its own decoder
+        cnpy::NpzSaveOptions deflate;
+        deflate.compression = cnpy::Compression::Deflate;
+        cnpy::NpzWriter npz("threads.npz");
+        for(size_t i = 0; i < ARRAYS; i++)
+            npz.add("a" + std::to_string(i), values(i).data(), {(i+1)*100, 10},
+                    i%2 ? deflate : cnpy::NpzSaveOptions());
+    }
+
+    const cnpy::NpzArchive npz("threads.npz");
+    std::atomic<size_t> failures(0);
+    std::vector<std::thread> threads;
+    for(size_t t = 0; t < THREADS; t++)
+        threads.emplace_back([&npz, &failures, t]() {
+            try
+            {
+                loadArrays(npz, t);
+                CHECK(npz.loadAll(2).size() == ARRAYS);
+            }
+            catch(std::exception& e)
+            {
+                std::cerr << e.what() << std::endl;
+                failures++;
+            }
+        });
+    for(std::thread& thread: threads)
+        thread.join();
+    CHECK(failures == 0);
+
+    std::cout << "npz threads test passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <complex>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "cnpy.h"
+#include "check.h"
+
+static void checkArray(const cnpy::NpArray& arr, const void* data, const std::vector<size_t>& shape,
+                       const cnpy::Type dtype, const bool fortran=false)
+{
+    CHECK(arr.nDims() == shape.size());
+    for(size_t i = 0; i < shape.size(); i++)
+        CHECK(arr.shape(i) == shape[i]);
+    CHECK(arr.dtype() == dtype);
+    CHECK(arr.isFortranOrder() == fortran);
+    CHECK(std::memcmp(arr.data(), data, arr.size()) == 0);
+}
+
+int main()
+{
+    std::vector<double> doubles(1000);
+    for(size_t i = 0; i < doubles.size(); i++)
+        doubles[i] = 0.25*i;
+    std::vector<std::complex<float>> complexes(30);
+    for(size_t i = 0; i < complexes.size(); i++)
+        complexes[i] = std::complex<float>(i, -float(i));
+    std::vector<int16_t> fortranData(6*4);
+    for(size_t i = 0; i < fortranData.size(); i++)
+        fortranData[i] = int16_t(i);
+    const cnpy::NpArray fortran({6, 4}, sizeof(int16_t), cnpy::Type::Int16, true,
+                                reinterpret_cast<const unsigned char*>(fortranData.data()));
+
+    cnpy::NpArrayDict dict;
+    dict.insert(std::make_pair("first", cnpy::NpArray({3}, sizeof(double), cnpy::Type::Double, false,
+                                                      reinterpret_cast<const unsigned char*>(doubles.data()))));
+    dict.insert(std::make_pair("second", cnpy::NpArray({2, 2}, sizeof(double), cnpy::Type::Double, false,
+                                                       reinterpret_cast<const unsigned char*>(doubles.data()+3))));
+
+    {
+        cnpy::NpzWriter npz("writer.npz");
+        npz.add("doubles", doubles.data(), {10, 100});
+        npz.add("complexes", complexes.data(), {30});
+        npz.add("fortran", fortran);
+        npz.add(dict);
+        //the destructor writes the central directory
+    }
+
+    cnpy::NpArrayDict arrays = cnpy::npz_load("writer.npz");
+    CHECK(arrays.size() == 5);
+    checkArray(arrays["doubles"], doubles.data(), {10, 100}, cnpy::Type::Double);
+    checkArray(arrays["complexes"], complexes.data(), {30}, cnpy::Type::ComplexFloat);
+    checkArray(arrays["fortran"], fortranData.data(), {6, 4}, cnpy::Type::Int16, true);
+    checkArray(arrays["first"], doubles.data(), {3}, cnpy::Type::Double);
+    checkArray(arrays["second"], doubles.data()+3, {2, 2}, cnpy::Type::Double);
+
+    //npz_save with mode 'w' goes through the writer as well
+    cnpy::npz_save("writer.npz", "only", doubles.data(), {1000});
+    arrays = cnpy::npz_load("writer.npz");
+    CHECK(arrays.size() == 1);
+    checkArray(arrays["only"], doubles.data(), {1000}, cnpy::Type::Double);
+
+    //closing twice is harmless, adding after close is not
+    cnpy::NpzWriter npz("writer.npz");
+    npz.add("a", doubles.data(), {4});
+    npz.close();
+    npz.close();
+    CHECK_THROWS(npz.add("b", doubles.data(), {4}));
+    checkArray(cnpy::npz_load("writer.npz", "a"), doubles.data(), {4}, cnpy::Type::Double);
+
+    std::cout << "npz writer test passed" << std::endl;
+    return 0;
+}
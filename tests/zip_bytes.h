@@ -0,0 +1,79 @@
+#ifndef CNPY_TESTS_ZIP_BYTES_H_
+#define CNPY_TESTS_ZIP_BYTES_H_
+
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "check.h"
+
+typedef std::vector<unsigned char> Bytes;
+
+inline Bytes readFile(const std::string& fname)
+{
+    std::ifstream file(fname, std::ios::binary);
+    return Bytes(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+inline void writeFile(const std::string& fname, const Bytes& bytes)
+{
+    std::ofstream file(fname, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+inline size_t le16(const Bytes& bytes, const size_t pos)
+{
+    return bytes[pos] | bytes[pos+1]<<8;
+}
+
+inline uint32_t le32(const Bytes& bytes, const size_t pos)
+{
+    return bytes[pos] | bytes[pos+1]<<8 | bytes[pos+2]<<16 | uint32_t(bytes[pos+3])<<24;
+}
+
+inline void setLe32(Bytes& bytes, const size_t pos, const uint32_t value)
+{
+    for(size_t i = 0; i < 4; i++)
+        bytes[pos+i] = (value >> 8*i) & 0xFF;
+}
+
+//offset of the central directory, from the end of central directory record; the archive has no comment
+inline size_t centralDirectoryOffset(const Bytes& bytes)
+{
+    CHECK(bytes.size() >= 22);
+    const size_t eocd = bytes.size()-22;
+    CHECK(le32(bytes, eocd) == 0x06054b50);
+    return le32(bytes, eocd+16);
+}
+
+//names of the central directory records
+inline std::vector<std::string> entryNames(const Bytes& bytes)
+{
+    std::vector<std::string> names;
+    size_t pos = centralDirectoryOffset(bytes);
+    while(le32(bytes, pos) == 0x02014b50)
+    {
+        names.push_back(std::string(reinterpret_cast<const char*>(&bytes[pos+46]), le16(bytes, pos+28)));
+        pos += 46 + le16(bytes, pos+28) + le16(bytes, pos+30) + le16(bytes, pos+32);
+    }
+    return names;
+}
+
+//position of the central directory record of `name`
+inline size_t centralHeader(const Bytes& bytes, const std::string& name)
+{
+    size_t pos = centralDirectoryOffset(bytes);
+    while(le32(bytes, pos) == 0x02014b50)
+    {
+        const size_t nameLen = le16(bytes, pos+28);
+        if(std::string(reinterpret_cast<const char*>(&bytes[pos+46]), nameLen) == name)
+            return pos;
+        pos += 46 + nameLen + le16(bytes, pos+30) + le16(bytes, pos+32);
+    }
+    CHECK(!"entry not found");
+    return 0;
+}
+
+#endif